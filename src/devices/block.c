@@ -5,6 +5,10 @@
 #include "devices/ide.h"
 #include "threads/malloc.h"
 
+/*! Sectors handed to the driver per request by block_read_multiple() and
+    block_write_multiple(), which build their buffer vectors on the stack. */
+#define BLOCK_VECTOR_BATCH 16
+
 /*! A block device. */
 struct block {
     struct list_elem list_elem;         /*!< Element in all_blocks. */
@@ -18,6 +22,8 @@ struct block {
 
     unsigned long long read_cnt;        /*!< Number of sectors read. */
     unsigned long long write_cnt;       /*!< Number of sectors written. */
+    unsigned long long read_req_cnt;    /*!< Number of read requests. */
+    unsigned long long write_req_cnt;   /*!< Number of write requests. */
 };
 
 /*! List of all block devices. */
@@ -93,6 +99,17 @@ static void check_sector(struct block *block, block_sector_t sector) {
     }
 }
 
+/*! Verifies that the CNT sectors starting at SECTOR all lie within BLOCK.
+    Panics if not. */
+static void check_sectors(struct block *block, block_sector_t sector,
+                          size_t cnt) {
+    if (cnt > block->size || sector > block->size - cnt) {
+        PANIC("Access past end of device %s (sector=%"PRDSNu", count=%zu, "
+              "size=%"PRDSNu")\n", block_name(block), sector, cnt,
+              block->size);
+    }
+}
+
 /*! Reads sector SECTOR from BLOCK into BUFFER, which must
     have room for BLOCK_SECTOR_SIZE bytes.
     Internally synchronizes accesses to block devices, so external
@@ -101,6 +118,7 @@ void block_read(struct block *block, block_sector_t sector, void *buffer) {
     check_sector(block, sector);
     block->ops->read(block->aux, sector, buffer);
     block->read_cnt++;
+    block->read_req_cnt++;
 }
 
 /*! Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -114,6 +132,124 @@ void block_write(struct block *block, block_sector_t sector,
     ASSERT(block->type != BLOCK_FOREIGN);
     block->ops->write(block->aux, sector, buffer);
     block->write_cnt++;
+    block->write_req_cnt++;
+}
+
+/*! Reads the CNT consecutive sectors starting at SECTOR from BLOCK, each into
+    the corresponding entry of BUFFERS, which must have room for
+    BLOCK_SECTOR_SIZE bytes apiece.  Devices that support it do this with one
+    request instead of CNT.
+    Internally synchronizes accesses to block devices, so external
+    per-block device locking is unneeded. */
+void block_read_vector(struct block *block, block_sector_t sector,
+                       void *const buffers[], size_t cnt) {
+    size_t i;
+
+    if (cnt == 0)
+        return;
+    check_sectors(block, sector, cnt);
+    if (block->ops->read_vector != NULL) {
+        block->ops->read_vector(block->aux, sector, buffers, cnt);
+        block->read_req_cnt++;
+    } else {
+        for (i = 0; i < cnt; i++)
+            block->ops->read(block->aux, sector + i, buffers[i]);
+        block->read_req_cnt += cnt;
+    }
+    block->read_cnt += cnt;
+}
+
+/*! Writes the CNT consecutive sectors starting at SECTOR to BLOCK, each from
+    the corresponding entry of BUFFERS, which must contain BLOCK_SECTOR_SIZE
+    bytes apiece.  Devices that support it do this with one request instead
+    of CNT.  Returns after the block device has acknowledged receiving all of
+    the data.
+    Internally synchronizes accesses to block devices, so external
+    per-block device locking is unneeded. */
+void block_write_vector(struct block *block, block_sector_t sector,
+                        const void *const buffers[], size_t cnt) {
+    size_t i;
+
+    if (cnt == 0)
+        return;
+    check_sectors(block, sector, cnt);
+    ASSERT(block->type != BLOCK_FOREIGN);
+    if (block->ops->write_vector != NULL) {
+        block->ops->write_vector(block->aux, sector, buffers, cnt);
+        block->write_req_cnt++;
+    } else {
+        for (i = 0; i < cnt; i++)
+            block->ops->write(block->aux, sector + i, buffers[i]);
+        block->write_req_cnt += cnt;
+    }
+    block->write_cnt += cnt;
+}
+
+/*! Starts carrying out REQUEST on BLOCK.  Devices that can queue requests
+    return at once and call REQUEST's completion function when it finishes;
+    for others the transfer is done, and the function called, before
+    returning. */
+void block_submit(struct block *block, struct block_request *request) {
+    ASSERT(request->cnt > 0);
+
+    if (block->ops->submit == NULL) {
+        if (request->write)
+            block_write_vector(block, request->sector,
+                               (const void *const *) request->buffers,
+                               request->cnt);
+        else
+            block_read_vector(block, request->sector, request->buffers,
+                              request->cnt);
+        request->done(request);
+        return;
+    }
+
+    check_sectors(block, request->sector, request->cnt);
+    if (request->write) {
+        ASSERT(block->type != BLOCK_FOREIGN);
+        block->write_cnt += request->cnt;
+        block->write_req_cnt++;
+    } else {
+        block->read_cnt += request->cnt;
+        block->read_req_cnt++;
+    }
+    block->ops->submit(block->aux, request);
+}
+
+/*! Reads the CNT consecutive sectors starting at SECTOR from BLOCK into
+    BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE bytes. */
+void block_read_multiple(struct block *block, block_sector_t sector,
+                         size_t cnt, void *buffer) {
+    void *buffers[BLOCK_VECTOR_BATCH];
+    size_t i, n;
+
+    while (cnt > 0) {
+        n = cnt < BLOCK_VECTOR_BATCH ? cnt : BLOCK_VECTOR_BATCH;
+        for (i = 0; i < n; i++)
+            buffers[i] = (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE;
+        block_read_vector(block, sector, buffers, n);
+        sector += n;
+        cnt -= n;
+        buffer = (uint8_t *) buffer + n * BLOCK_SECTOR_SIZE;
+    }
+}
+
+/*! Writes the CNT consecutive sectors starting at SECTOR to BLOCK from
+    BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+void block_write_multiple(struct block *block, block_sector_t sector,
+                          size_t cnt, const void *buffer) {
+    const void *buffers[BLOCK_VECTOR_BATCH];
+    size_t i, n;
+
+    while (cnt > 0) {
+        n = cnt < BLOCK_VECTOR_BATCH ? cnt : BLOCK_VECTOR_BATCH;
+        for (i = 0; i < n; i++)
+            buffers[i] = (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE;
+        block_write_vector(block, sector, buffers, n);
+        sector += n;
+        cnt -= n;
+        buffer = (const uint8_t *) buffer + n * BLOCK_SECTOR_SIZE;
+    }
 }
 
 /*! Writes a block with all 0s to verify correctness of other functions. */
@@ -146,11 +282,14 @@ void block_print_stats(void) {
     for (i = 0; i < BLOCK_ROLE_CNT; i++) {
         struct block *block = block_by_role[i];
         if (block != NULL) {
-            printf("%s (%s): %llu reads, %llu writes\n",
+            printf("%s (%s): %llu reads, %llu writes "
+                   "(%llu read requests, %llu write requests)\n",
                    block->name, block_type_name(block->type),
-                   block->read_cnt, block->write_cnt);
+                   block->read_cnt, block->write_cnt,
+                   block->read_req_cnt, block->write_req_cnt);
         }
     }
+    ide_print_stats();
 }
 
 /*! Registers a new block device with the given NAME.  If EXTRA_INFO is
@@ -172,6 +311,8 @@ struct block * block_register(const char *name, enum block_type type,
     block->aux = aux;
     block->read_cnt = 0;
     block->write_cnt = 0;
+    block->read_req_cnt = 0;
+    block->write_req_cnt = 0;
 
     printf("%s: %'"PRDSNu" sectors (", block->name, block->size);
     print_human_readable_size((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /*! Size of a block device sector in bytes.  All IDE disks use this sector
     size, as do most USB and SCSI disks.  It's not worth it to try to cater
@@ -52,10 +54,39 @@ struct block *block_next(struct block *);
 block_sector_t block_size(struct block *);
 void block_read(struct block *, block_sector_t, void *);
 void block_write(struct block *, block_sector_t, const void *);
+void block_read_multiple(struct block *, block_sector_t, size_t cnt, void *);
+void block_write_multiple(struct block *, block_sector_t, size_t cnt,
+                          const void *);
+void block_read_vector(struct block *, block_sector_t,
+                       void *const buffers[], size_t cnt);
+void block_write_vector(struct block *, block_sector_t,
+                        const void *const buffers[], size_t cnt);
 void block_clear(struct block *, block_sector_t);
 const char *block_name(struct block *);
 enum block_type block_type(struct block *);
 
+/*! An asynchronous request to transfer CNT consecutive sectors starting at
+    SECTOR to or from BUFFERS, one buffer of BLOCK_SECTOR_SIZE bytes per
+    sector.  The submitter fills in the public members and must leave the
+    request alone until DONE is called, which may happen on another thread
+    and may be before block_submit() returns. */
+struct block_request {
+    bool write;                 /*!< True to write, false to read. */
+    block_sector_t sector;      /*!< First sector.  Drivers may change it. */
+    size_t cnt;                 /*!< Number of sectors. */
+    void *const *buffers;       /*!< CNT sector buffers. */
+    void (*done)(struct block_request *);   /*!< Completion callback. */
+    void *aux;                  /*!< For use by DONE. */
+
+    /*! Owned by the driver while the request is outstanding. @{ */
+    struct list_elem elem;
+    void *driver;
+    int64_t deadline;
+    /*! @} */
+};
+
+void block_submit(struct block *, struct block_request *);
+
 /* Statistics. */
 void block_print_stats(void);
 
@@ -64,6 +95,18 @@ void block_print_stats(void);
 struct block_operations {
     void (*read)(void *aux, block_sector_t, void *buffer);
     void (*write)(void *aux, block_sector_t, const void *buffer);
+
+    /*! Optional.  Transfer CNT consecutive sectors starting at the given one,
+        each to or from its own entry in BUFFERS, as a single request.
+        Devices that leave these null get one read or write per sector. */
+    void (*read_vector)(void *aux, block_sector_t,
+                        void *const buffers[], size_t cnt);
+    void (*write_vector)(void *aux, block_sector_t,
+                         const void *const buffers[], size_t cnt);
+
+    /*! Optional.  Queue REQUEST and return without waiting for it.  Devices
+        that leave this null have requests carried out synchronously. */
+    void (*submit)(void *aux, struct block_request *request);
 };
 
 struct block *block_register(const char *name, enum block_type,
@@ -10,10 +10,14 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
 /*! ATA command block port addresses. @{ */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)    /*!< Data. */
@@ -34,10 +38,25 @@
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)      /*!< Alt Status (r/o). */
 /*! @} */
 
+/*! Bus master IDE port addresses, for channels with DMA.  (The PIIX puts
+    them in I/O space at BAR4, eight ports per channel.) @{ */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /*!< Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /*!< Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /*!< PRD table. */
+/*! @} */
+
 /*! Alternate Status Register bits. @{ */
 #define STA_BSY 0x80            /*!< Busy. */
 #define STA_DRDY 0x40           /*!< Device Ready. */
 #define STA_DRQ 0x08            /*!< Data Request. */
+#define STA_ERR 0x01            /*!< Error. */
+/*! @} */
+
+/*! Bus master command and status register bits. @{ */
+#define BM_CMD_START 0x01       /*!< Start transfer. */
+#define BM_CMD_READ 0x08        /*!< Transfer from disk to memory. */
+#define BM_STA_ERROR 0x02       /*!< Transfer failed (write 1 to clear). */
+#define BM_STA_IRQ 0x04         /*!< Disk interrupted (write 1 to clear). */
 /*! @} */
 
 /*! Control Register bits. @{ */
@@ -53,16 +72,40 @@
 /*! Commands.
     Many more are defined but this is the small subset that we use. @{ */
 #define CMD_IDENTIFY_DEVICE 0xec        /*!< IDENTIFY DEVICE. */
-#define CMD_READ_SECTOR_RETRY 0x20      /*!< READ SECTOR with retries. */
-#define CMD_WRITE_SECTOR_RETRY 0x30     /*!< WRITE SECTOR with retries. */
+#define CMD_READ_SECTOR_RETRY 0x20      /*!< READ SECTOR(S) with retries. */
+#define CMD_WRITE_SECTOR_RETRY 0x30     /*!< WRITE SECTOR(S) with retries. */
+#define CMD_READ_DMA 0xc8               /*!< READ DMA. */
+#define CMD_WRITE_DMA 0xca              /*!< WRITE DMA. */
+/*! @} */
+
+/*! Most sectors a single READ or WRITE SECTOR(S) command can move.  The
+    sector count register holds 0 to mean this many. */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/*! How long a request may wait in the queue, in timer ticks, before it is
+    served ahead of the elevator order.  Reads usually have a thread
+    waiting on them; writes are mostly flushes nobody waits for. @{ */
+#define READ_DEADLINE (TIMER_FREQ / 10)
+#define WRITE_DEADLINE (TIMER_FREQ / 2)
 /*! @} */
 
+/*! Physical region descriptor, an entry in a bus master's scatter/gather
+    list.  A region may not cross a 64 kB boundary. */
+struct prd {
+    uint32_t addr;              /*!< Physical address. */
+    uint16_t size;              /*!< Size in bytes, even, 0 meaning 64 kB. */
+    uint16_t flags;             /*!< PRD_EOT on the last entry. */
+};
+#define PRD_EOT 0x8000          /*!< End of table. */
+#define PRD_MAX (PGSIZE / sizeof (struct prd)) /*!< Entries per table. */
+
 /*! An ATA device. */
 struct ata_disk {
     char name[8];               /*!< Name, e.g. "hda". */
     struct channel *channel;    /*!< Channel that disk is attached to. */
     int dev_no;                 /*!< Device 0 or 1 for master or slave. */
     bool is_ata;                /*!< Is device an ATA disk? */
+    bool dma;                   /*!< Use DMA for this disk? */
 };
 
 /*! An ATA channel (aka controller).
@@ -72,12 +115,37 @@ struct channel {
     uint16_t reg_base;          /*!< Base I/O port. */
     uint8_t irq;                /*!< Interrupt in use. */
 
-    struct lock lock;           /*!< Must acquire to access the controller. */
     bool expecting_interrupt;   /*!< True if an interrupt is expected, false if
                                      any interrupt would be spurious. */
     struct semaphore completion_wait;   /*!< Up'd by interrupt handler. */
 
     struct ata_disk devices[2];     /*!< The devices on this channel. */
+
+    /*! Bus mastering, if the controller supports it. @{ */
+    uint16_t bm_base;           /*!< Base I/O port, or 0 for PIO only. */
+    struct prd *prdt;           /*!< PRD table, one page. */
+    void *cmd_buffers[MAX_SECTORS_PER_COMMAND]; /*!< Sectors of a command. */
+    /*! @} */
+
+    /*! Requests waiting for the channel, in order of submission.  Only the
+        channel's service thread touches the controller once the disks are
+        identified; everyone else queues requests for it. @{ */
+    struct lock lock;           /*!< Protects the members below. */
+    struct condition queue_ready;   /*!< Signalled when a request arrives. */
+    struct list queue;          /*!< Queued block_requests. */
+    size_t queue_cnt;           /*!< Number of requests in queue. */
+    uint32_t head;              /*!< Elevator position, see request_key(). */
+    /*! @} */
+
+    /*! Statistics. @{ */
+    unsigned long long request_cnt;     /*!< Requests submitted. */
+    unsigned long long command_cnt;     /*!< Commands issued for them. */
+    unsigned long long dma_cnt;         /*!< ...of which used DMA. */
+    unsigned long long merge_cnt;       /*!< Requests merged into another's. */
+    unsigned long long expired_cnt;     /*!< Served early for deadlines. */
+    unsigned long long depth_sum;       /*!< Sum of depths seen on submit. */
+    size_t depth_max;                   /*!< Deepest the queue has been. */
+    /*! @} */
 };
 
 /* We support the two "legacy" ATA channels found in a standard PC. */
@@ -90,7 +158,9 @@ static void reset_channel(struct channel *);
 static bool check_device_type(struct ata_disk *);
 static void identify_ata_device(struct ata_disk *);
 
-static void select_sector(struct ata_disk *, block_sector_t);
+static uint16_t find_bus_master(void);
+
+static void select_sector(struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command(struct channel *, uint8_t command);
 static void input_sector(struct channel *, void *);
 static void output_sector(struct channel *, const void *);
@@ -102,8 +172,19 @@ static void select_device_wait(const struct ata_disk *);
 
 static void interrupt_handler(struct intr_frame *);
 
+static void ide_service(void *channel_);
+static struct block_request *pick_request(struct channel *);
+static bool request_blocked(struct channel *, struct block_request *);
+static void transfer_requests(struct channel *, struct list *batch,
+                              block_sector_t sec_no, size_t cnt);
+static void pio_transfer(struct channel *, struct ata_disk *, bool write,
+                         block_sector_t sec_no, size_t cnt);
+static bool dma_transfer(struct channel *, struct ata_disk *, bool write,
+                         block_sector_t sec_no, size_t cnt);
+
 /*! Initialize the disk subsystem and detect disks. */
 void ide_init (void) {
+    uint16_t bm_base = find_bus_master();
     size_t chan_no;
 
     for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++) {
@@ -124,9 +205,22 @@ void ide_init (void) {
         default:
             NOT_REACHED();
         }
-        lock_init(&c->lock);
         c->expecting_interrupt = false;
         sema_init(&c->completion_wait, 0);
+        lock_init(&c->lock);
+        cond_init(&c->queue_ready);
+        list_init(&c->queue);
+        c->queue_cnt = 0;
+        c->head = 0;
+
+        /* Use DMA if we have a bus master and a page for its PRD table. */
+        c->bm_base = 0;
+        c->prdt = NULL;
+        if (bm_base != 0) {
+            c->prdt = palloc_get_page(0);
+            if (c->prdt != NULL)
+                c->bm_base = bm_base + chan_no * 8;
+        }
  
         /* Initialize devices. */
         for (dev_no = 0; dev_no < 2; dev_no++) {
@@ -136,6 +230,7 @@ void ide_init (void) {
             d->channel = c;
             d->dev_no = dev_no;
             d->is_ata = false;
+            d->dma = false;
         }
 
         /* Register interrupt handler. */
@@ -148,6 +243,13 @@ void ide_init (void) {
         if (check_device_type(&c->devices[0]))
             check_device_type(&c->devices[1]);
 
+        /* Registering a disk reads its partition table, which goes through
+           the request queue, so the service thread has to be running by
+           then.  Nothing is queued until then, so it leaves the controller
+           to us while we identify the disks. */
+        if (c->devices[0].is_ata || c->devices[1].is_ata)
+            thread_create(c->name, PRI_DEFAULT, ide_service, c);
+
         /* Read hard disk identity information. */
         for (dev_no = 0; dev_no < 2; dev_no++) {
             if (c->devices[dev_no].is_ata)
@@ -158,6 +260,32 @@ void ide_init (void) {
 
 /* Disk detection and identification. */
 
+/*! Looks for a PCI IDE controller that can act as a bus master while
+    driving the legacy channels, as the PIIX in a PC (or QEMU) does.  If one
+    is found, enables bus mastering and returns the base of its bus master
+    registers.  Otherwise returns 0, and all transfers use PIO. */
+static uint16_t find_bus_master(void) {
+    struct pci_func f;
+    uint32_t prog_if, bar4, command;
+
+    if (!pci_find_class(0x01, 0x01, &f))
+        return 0;
+
+    /* Bit 7 says it can bus master.  Bits 0 and 2 would mean a channel runs
+       in native mode, at ports other than the ones we drive. */
+    prog_if = (pci_read_config(f, PCI_REG_CLASS) >> 8) & 0xff;
+    if ((prog_if & 0x80) == 0 || (prog_if & 0x05) != 0)
+        return 0;
+    bar4 = pci_read_config(f, PCI_REG_BAR4);
+    if ((bar4 & 1) == 0)
+        return 0;
+
+    command = pci_read_config(f, PCI_REG_COMMAND) & 0xffff;
+    pci_write_config(f, PCI_REG_COMMAND,
+                     command | PCI_CMD_IO | PCI_CMD_MASTER);
+    return bar4 & 0xfffc;
+}
+
 static char *descramble_ata_string(char *, int size);
 
 /*! Resets an ATA channel and waits for any devices present on it
@@ -268,6 +396,7 @@ static void identify_ata_device(struct ata_disk *d) {
 
     /* Calculate capacity.  Read model name and serial number. */
     capacity = *(uint32_t *) &id[60 * 2];
+    d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
     model = descramble_ata_string(&id[10 * 2], 20);
     serial = descramble_ata_string(&id[27 * 2], 40);
     snprintf(extra_info, sizeof(extra_info),
@@ -315,53 +444,380 @@ static char * descramble_ata_string(char *string, int size) {
     return string;
 }
 
-/*! Reads sector SEC_NO from disk D into BUFFER, which must have room for
-    BLOCK_SECTOR_SIZE bytes.  Internally synchronizes accesses to disks,
-    so external per-disk locking is unneeded. */
-static void ide_read(void *d_, block_sector_t sec_no, void *buffer) {
+/*! Queues REQUEST for disk D and returns.  The channel's service thread
+    calls REQUEST's completion function once the transfer is done. */
+static void ide_submit(void *d_, struct block_request *request) {
     struct ata_disk *d = d_;
     struct channel *c = d->channel;
+
+    ASSERT(request->cnt > 0);
+    ASSERT(request->sector + request->cnt <= (1UL << 28));
+
+    request->driver = d;
+    request->deadline = timer_ticks() +
+        (request->write ? WRITE_DEADLINE : READ_DEADLINE);
+
     lock_acquire(&c->lock);
-    select_sector(d, sec_no);
-    issue_pio_command(c, CMD_READ_SECTOR_RETRY);
-    sema_down(&c->completion_wait);
-    if (!wait_while_busy(d))
-        PANIC("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-    input_sector(c, buffer);
+    list_push_back(&c->queue, &request->elem);
+    c->queue_cnt++;
+    c->request_cnt++;
+    c->depth_sum += c->queue_cnt;
+    if (c->queue_cnt > c->depth_max)
+        c->depth_max = c->queue_cnt;
+    cond_signal(&c->queue_ready, &c->lock);
     lock_release(&c->lock);
 }
 
+/*! Completion function for the synchronous operations below. */
+static void wake_submitter(struct block_request *request) {
+    sema_up(request->aux);
+}
+
+/*! Reads the CNT sectors starting at SEC_NO from disk D, each into the
+    corresponding entry of BUFFERS, which must have room for
+    BLOCK_SECTOR_SIZE bytes apiece, and waits for the data to arrive.
+    Internally synchronizes accesses to disks, so external per-disk locking
+    is unneeded. */
+static void ide_read_vector(void *d_, block_sector_t sec_no,
+                            void *const buffers[], size_t cnt) {
+    struct block_request request;
+    struct semaphore done;
+
+    sema_init(&done, 0);
+    request.write = false;
+    request.sector = sec_no;
+    request.cnt = cnt;
+    request.buffers = buffers;
+    request.done = wake_submitter;
+    request.aux = &done;
+    ide_submit(d_, &request);
+    sema_down(&done);
+}
+
+/*! Writes the CNT sectors starting at SEC_NO to disk D, each from the
+    corresponding entry of BUFFERS, which must contain BLOCK_SECTOR_SIZE
+    bytes apiece.  Returns after the disk has acknowledged receiving all of
+    the data.  Internally synchronizes accesses to disks, so external
+    per-disk locking is unneeded. */
+static void ide_write_vector(void *d_, block_sector_t sec_no,
+                             const void *const buffers[], size_t cnt) {
+    struct block_request request;
+    struct semaphore done;
+
+    sema_init(&done, 0);
+    request.write = true;
+    request.sector = sec_no;
+    request.cnt = cnt;
+    /* Only ever read from, since this is a write. */
+    request.buffers = (void *const *) buffers;
+    request.done = wake_submitter;
+    request.aux = &done;
+    ide_submit(d_, &request);
+    sema_down(&done);
+}
+
+/*! Reads sector SEC_NO from disk D into BUFFER, which must have room for
+    BLOCK_SECTOR_SIZE bytes.  Internally synchronizes accesses to disks,
+    so external per-disk locking is unneeded. */
+static void ide_read(void *d_, block_sector_t sec_no, void *buffer) {
+    ide_read_vector(d_, sec_no, &buffer, 1);
+}
+
 /*! Write sector SEC_NO to disk D from BUFFER, which must contain
     BLOCK_SECTOR_SIZE bytes.  Returns after the disk has acknowledged
     receiving the data.  Internally synchronizes accesses to disks, so external
     per-disk locking is unneeded. */
 static void ide_write(void *d_, block_sector_t sec_no, const void *buffer) {
-    struct ata_disk *d = d_;
-    struct channel *c = d->channel;
-    lock_acquire(&c->lock);
-    select_sector(d, sec_no);
-    issue_pio_command(c, CMD_WRITE_SECTOR_RETRY);
-    if (!wait_while_busy(d))
-        PANIC("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-    output_sector(c, buffer);
-    sema_down(&c->completion_wait);
-    lock_release(&c->lock);
+    ide_write_vector(d_, sec_no, &buffer, 1);
 }
 
 static struct block_operations ide_operations = {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_vector,
+    ide_write_vector,
+    ide_submit
 };
-
+
+/* Request scheduling. */
+
+/*! Returns the position of REQUEST on the elevator's single axis: its disk,
+    then its first sector.  (Sectors fit in 28 bits.) */
+static uint32_t request_key(const struct block_request *request) {
+    const struct ata_disk *d = request->driver;
+    return ((uint32_t) d->dev_no << 28) | request->sector;
+}
+
+/*! Returns true if REQUEST and OTHER touch a common sector on the same disk
+    and at least one of them writes, so that their order matters. */
+static bool requests_conflict(const struct block_request *request,
+                              const struct block_request *other) {
+    return request->driver == other->driver
+        && (request->write || other->write)
+        && request->sector < other->sector + other->cnt
+        && other->sector < request->sector + request->cnt;
+}
+
+/*! Returns true if REQUEST cannot be served yet because a request queued
+    before it on channel C conflicts with it. */
+static bool request_blocked(struct channel *c, struct block_request *request) {
+    struct list_elem *e;
+
+    for (e = list_begin(&c->queue); e != &request->elem; e = list_next(e)) {
+        if (requests_conflict(list_entry(e, struct block_request, elem),
+                              request))
+            return true;
+    }
+    return false;
+}
+
+/*! Chooses the next request to serve on channel C, whose lock must be held
+    and whose queue must not be empty.  Normally this is C-LOOK: the nearest
+    request at or past the head in ascending order, wrapping around to the
+    lowest once there is none.  A request that has waited past its deadline
+    is served first instead, so that a stream of nearby requests cannot
+    starve one far away. */
+static struct block_request *pick_request(struct channel *c) {
+    struct block_request *oldest, *ahead = NULL, *lowest = NULL;
+    struct list_elem *e;
+
+    ASSERT(!list_empty(&c->queue));
+
+    /* Requests are queued in order of submission, so the oldest one is at
+       the front and is never blocked. */
+    oldest = list_entry(list_front(&c->queue), struct block_request, elem);
+    if (timer_ticks() >= oldest->deadline) {
+        c->expired_cnt++;
+        return oldest;
+    }
+
+    for (e = list_begin(&c->queue); e != list_end(&c->queue);
+         e = list_next(e)) {
+        struct block_request *r = list_entry(e, struct block_request, elem);
+        uint32_t key = request_key(r);
+        if (request_blocked(c, r))
+            continue;
+        if (key >= c->head && (ahead == NULL || key < request_key(ahead)))
+            ahead = r;
+        if (lowest == NULL || key < request_key(lowest))
+            lowest = r;
+    }
+    return ahead != NULL ? ahead : lowest;
+}
+
+/*! Service thread for channel C.  Takes requests off the queue one at a time
+    in the order pick_request() chooses, along with any others that pick up
+    exactly where it leaves off in the same direction, and carries each such
+    batch out with as few commands as possible. */
+static void ide_service(void *c_) {
+    struct channel *c = c_;
+
+    while (true) {
+        struct block_request *first, *r;
+        struct list batch;
+        struct list_elem *e;
+        block_sector_t end;
+        size_t cnt;
+        bool merged;
+
+        lock_acquire(&c->lock);
+        while (list_empty(&c->queue))
+            cond_wait(&c->queue_ready, &c->lock);
+        first = pick_request(c);
+        list_remove(&first->elem);
+        c->queue_cnt--;
+        list_init(&batch);
+        list_push_back(&batch, &first->elem);
+
+        /* Merge requests that continue the batch, as long as the result
+           still fits in one command. */
+        end = first->sector + first->cnt;
+        cnt = first->cnt;
+        do {
+            merged = false;
+            for (e = list_begin(&c->queue); e != list_end(&c->queue);
+                 e = list_next(e)) {
+                r = list_entry(e, struct block_request, elem);
+                if (r->driver == first->driver && r->write == first->write
+                    && r->sector == end
+                    && cnt + r->cnt <= MAX_SECTORS_PER_COMMAND
+                    && !request_blocked(c, r)) {
+                    list_remove(&r->elem);
+                    c->queue_cnt--;
+                    c->merge_cnt++;
+                    list_push_back(&batch, &r->elem);
+                    end += r->cnt;
+                    cnt += r->cnt;
+                    merged = true;
+                    break;
+                }
+            }
+        } while (merged);
+        c->head = request_key(first) + cnt;
+        lock_release(&c->lock);
+
+        transfer_requests(c, &batch, first->sector, cnt);
+
+        /* Completion functions may free or reuse their requests. */
+        while (!list_empty(&batch)) {
+            r = list_entry(list_pop_front(&batch), struct block_request, elem);
+            r->done(r);
+        }
+    }
+}
+
+/*! Carries out the requests in BATCH on channel C.  They are all for the same
+    disk and in the same direction, and together cover the CNT sectors
+    starting at SEC_NO in order.  Each run of up to MAX_SECTORS_PER_COMMAND
+    sectors is a single command, by DMA where possible. */
+static void transfer_requests(struct channel *c, struct list *batch,
+                              block_sector_t sec_no, size_t cnt) {
+    struct list_elem *e = list_begin(batch);
+    struct block_request *r = list_entry(e, struct block_request, elem);
+    struct ata_disk *d = r->driver;
+    bool write = r->write;
+    size_t idx = 0, i, n;
+
+    for (; cnt > 0; sec_no += n, cnt -= n) {
+        n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+
+        /* Gather the command's buffers from the requests. */
+        for (i = 0; i < n; i++) {
+            if (idx == r->cnt) {
+                e = list_next(e);
+                r = list_entry(e, struct block_request, elem);
+                idx = 0;
+            }
+            c->cmd_buffers[i] = r->buffers[idx++];
+        }
+
+        if (!d->dma || !dma_transfer(c, d, write, sec_no, n))
+            pio_transfer(c, d, write, sec_no, n);
+        c->command_cnt++;
+    }
+}
+
+/*! Transfers the CNT sectors starting at SEC_NO on disk D to or from
+    channel C's cmd_buffers by PIO, the disk interrupting once per sector
+    and the CPU moving every word. */
+static void pio_transfer(struct channel *c, struct ata_disk *d, bool write,
+                         block_sector_t sec_no, size_t cnt) {
+    size_t i;
+
+    select_sector(d, sec_no, cnt);
+    issue_pio_command(c, write ? CMD_WRITE_SECTOR_RETRY
+                               : CMD_READ_SECTOR_RETRY);
+    for (i = 0; i < cnt; i++) {
+        if (write) {
+            if (!wait_while_busy(d))
+                PANIC("%s: disk write failed, sector=%"PRDSNu,
+                      d->name, sec_no + i);
+            output_sector(c, c->cmd_buffers[i]);
+            sema_down(&c->completion_wait);
+        } else {
+            sema_down(&c->completion_wait);
+            if (!wait_while_busy(d))
+                PANIC("%s: disk read failed, sector=%"PRDSNu,
+                      d->name, sec_no + i);
+            input_sector(c, c->cmd_buffers[i]);
+        }
+    }
+}
+
+/*! Transfers the CNT sectors starting at SEC_NO on disk D to or from
+    channel C's cmd_buffers by bus master DMA, sleeping until the single
+    interrupt at the end.  Returns false without touching the disk if a
+    buffer cannot be reached by DMA (it is not in kernel memory, or is not
+    word aligned), in which case the caller should fall back to PIO. */
+static bool dma_transfer(struct channel *c, struct ata_disk *d, bool write,
+                         block_sector_t sec_no, size_t cnt) {
+    uint8_t direction = write ? 0 : BM_CMD_READ;
+    size_t prd_cnt = 0, i;
+    uint8_t bm_status;
+
+    /* Describe the buffers, running physically adjacent ones together. */
+    for (i = 0; i < cnt; i++) {
+        const void *buffer = c->cmd_buffers[i];
+        uint32_t addr, left = BLOCK_SECTOR_SIZE;
+
+        if (!is_kernel_vaddr(buffer) || ((uintptr_t) buffer & 1) != 0)
+            return false;
+        addr = vtop(buffer);
+        while (left > 0) {
+            uint32_t room = 0x10000 - (addr & 0xffff);
+            uint32_t chunk = left < room ? left : room;
+            struct prd *last = prd_cnt > 0 ? &c->prdt[prd_cnt - 1] : NULL;
+
+            if (last != NULL && last->addr + last->size == addr
+                && last->addr >> 16 == addr >> 16
+                && last->size + chunk < 0x10000) {
+                last->size += chunk;
+            } else {
+                if (prd_cnt == PRD_MAX)
+                    return false;
+                c->prdt[prd_cnt].addr = addr;
+                c->prdt[prd_cnt].size = chunk;
+                c->prdt[prd_cnt].flags = 0;
+                prd_cnt++;
+            }
+            addr += chunk;
+            left -= chunk;
+        }
+    }
+    c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+    /* Point the bus master at the table, then start the disk and the bus
+       master in that order. */
+    outl(reg_bm_prdt(c), vtop(c->prdt));
+    outb(reg_bm_status(c), BM_STA_ERROR | BM_STA_IRQ);
+    outb(reg_bm_command(c), direction);
+    select_sector(d, sec_no, cnt);
+    issue_pio_command(c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+    outb(reg_bm_command(c), direction | BM_CMD_START);
+    sema_down(&c->completion_wait);
+
+    outb(reg_bm_command(c), direction);
+    bm_status = inb(reg_bm_status(c));
+    outb(reg_bm_status(c), BM_STA_ERROR | BM_STA_IRQ);
+    if ((bm_status & BM_STA_ERROR) != 0 || (inb(reg_alt_status(c)) & STA_ERR))
+        PANIC("%s: DMA %s failed, sector=%"PRDSNu,
+              d->name, write ? "write" : "read", sec_no);
+    c->dma_cnt++;
+    return true;
+}
+
+/*! Prints request queue statistics for each channel that has been used. */
+void ide_print_stats(void) {
+    struct channel *c;
+
+    for (c = channels; c < channels + CHANNEL_CNT; c++) {
+        unsigned long long depth_x100;
+
+        if (c->request_cnt == 0)
+            continue;
+        depth_x100 = c->depth_sum * 100 / c->request_cnt;
+        printf("%s: %llu requests in %llu commands (%llu by DMA, "
+               "%llu merged), queue depth %llu.%02llu mean, %zu max, "
+               "%llu past deadline\n",
+               c->name, c->request_cnt, c->command_cnt, c->dma_cnt,
+               c->merge_cnt,
+               depth_x100 / 100, depth_x100 % 100, c->depth_max,
+               c->expired_cnt);
+    }
+}
+
 /*! Selects device D, waiting for it to become ready, and then writes SEC_NO
-    to the disk's sector selection registers.  (We use LBA mode.) */
-static void select_sector(struct ata_disk *d, block_sector_t sec_no) {
+    and the count CNT to the disk's sector selection registers.  (We use LBA
+    mode.) */
+static void select_sector(struct ata_disk *d, block_sector_t sec_no,
+                          size_t cnt) {
     struct channel *c = d->channel;
 
     ASSERT(sec_no < (1UL << 28));
+    ASSERT(cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
   
     select_device_wait(d);
-    outb(reg_nsect(c), 1);
+    outb(reg_nsect(c), cnt % MAX_SECTORS_PER_COMMAND);
     outb(reg_lbal(c), sec_no);
     outb(reg_lbam(c), sec_no >> 8);
     outb(reg_lbah(c), (sec_no >> 16));
@@ -296,8 +296,34 @@ static void partition_write(void *p_, block_sector_t sector,
     block_write(p->block, p->start + sector, buffer);
 }
 
+/*! Reads the CNT sectors starting at SECTOR from partition P into
+    BUFFERS as a single request to the underlying device. */
+static void partition_read_vector(void *p_, block_sector_t sector,
+                                  void *const buffers[], size_t cnt) {
+    struct partition *p = p_;
+    block_read_vector(p->block, p->start + sector, buffers, cnt);
+}
+
+/*! Writes the CNT sectors starting at SECTOR to partition P from
+    BUFFERS as a single request to the underlying device. */
+static void partition_write_vector(void *p_, block_sector_t sector,
+                                   const void *const buffers[], size_t cnt) {
+    struct partition *p = p_;
+    block_write_vector(p->block, p->start + sector, buffers, cnt);
+}
+
+/*! Passes REQUEST for partition P on to the underlying device. */
+static void partition_submit(void *p_, struct block_request *request) {
+    struct partition *p = p_;
+    request->sector += p->start;
+    block_submit(p->block, request);
+}
+
 static struct block_operations partition_operations = {
     partition_read,
-    partition_write
+    partition_write,
+    partition_read_vector,
+    partition_write_vector,
+    partition_submit
 };
 
@@ -0,0 +1,73 @@
+/*! \file pci.c
+
+   Just enough of PCI configuration space access, through configuration
+   mechanism #1, to find a device by class and set it up. */
+
+#include "devices/pci.h"
+#include "threads/io.h"
+#include "threads/interrupt.h"
+
+/*! Configuration mechanism #1 ports. @{ */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+/*! @} */
+
+/*! Returns the CONFIG_ADDRESS value that selects register REG of F. */
+static uint32_t config_address(struct pci_func f, uint8_t reg) {
+    return 0x80000000 | ((uint32_t) f.bus << 16) | ((uint32_t) f.dev << 11)
+        | ((uint32_t) f.func << 8) | (reg & 0xfc);
+}
+
+/*! Returns the 32-bit configuration register REG of F.  REG must be a
+    multiple of 4. */
+uint32_t pci_read_config(struct pci_func f, uint8_t reg) {
+    enum intr_level old_level = intr_disable();
+    uint32_t value;
+
+    outl(PCI_CONFIG_ADDRESS, config_address(f, reg));
+    value = inl(PCI_CONFIG_DATA);
+    intr_set_level(old_level);
+    return value;
+}
+
+/*! Sets the 32-bit configuration register REG of F to VALUE.  REG must be a
+    multiple of 4. */
+void pci_write_config(struct pci_func f, uint8_t reg, uint32_t value) {
+    enum intr_level old_level = intr_disable();
+
+    outl(PCI_CONFIG_ADDRESS, config_address(f, reg));
+    outl(PCI_CONFIG_DATA, value);
+    intr_set_level(old_level);
+}
+
+/*! Searches the PCI buses for the first function with the given CLASS and
+    SUBCLASS.  If one is found, stores its location in *F and returns true;
+    otherwise returns false. */
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_func *f) {
+    unsigned bus, dev, func;
+
+    for (bus = 0; bus < 256; bus++) {
+        for (dev = 0; dev < 32; dev++) {
+            for (func = 0; func < 8; func++) {
+                struct pci_func cand = { bus, dev, func };
+                uint32_t id = pci_read_config(cand, 0);
+                uint32_t cls;
+
+                /* No function here.  Without function 0, there are no
+                   others either. */
+                if ((id & 0xffff) == 0xffff) {
+                    if (func == 0)
+                        break;
+                    continue;
+                }
+
+                cls = pci_read_config(cand, PCI_REG_CLASS);
+                if ((cls >> 24) == class && ((cls >> 16) & 0xff) == subclass) {
+                    *f = cand;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
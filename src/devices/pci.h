@@ -0,0 +1,29 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*! Location of a PCI function. */
+struct pci_func {
+    uint8_t bus;                /*!< Bus number. */
+    uint8_t dev;                /*!< Device number, 0 to 31. */
+    uint8_t func;               /*!< Function number, 0 to 7. */
+};
+
+/*! Offsets of configuration space registers that we use. @{ */
+#define PCI_REG_COMMAND 0x04    /*!< Command (16 bits). */
+#define PCI_REG_CLASS 0x08      /*!< Revision, prog-if, subclass, class. */
+#define PCI_REG_BAR4 0x20       /*!< Base address register 4. */
+/*! @} */
+
+/*! Command register bits. @{ */
+#define PCI_CMD_IO 0x0001       /*!< Respond to I/O space accesses. */
+#define PCI_CMD_MASTER 0x0004   /*!< May act as a bus master. */
+/*! @} */
+
+uint32_t pci_read_config(struct pci_func, uint8_t reg);
+void pci_write_config(struct pci_func, uint8_t reg, uint32_t value);
+bool pci_find_class(uint8_t class, uint8_t subclass, struct pci_func *);
+
+#endif /* devices/pci.h */
@@ -11,7 +11,14 @@
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "filesys/journal.h"
+#endif
+#ifdef VM
+#include "vm/frame.h"
 #endif
 
 /*! Keyboard control register port. */
@@ -108,11 +115,18 @@ static void print_stats(void) {
     thread_print_stats();
 #ifdef FILESYS
     block_print_stats();
+    cache_print_stats();
+    journal_print_stats();
+    dcache_print_stats();
+    inode_print_stats();
 #endif
     console_print_stats();
     kbd_print_stats();
 #ifdef USERPROG
     exception_print_stats();
 #endif
+#ifdef VM
+    frame_print_stats();
+#endif
 }
 
@@ -15,6 +15,8 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -28,29 +30,113 @@
 #include "vm/swap.h"
 
 
-#define CACHE_BLOCKS 64
-#define REFRESH_CACHE_MS 100 /* ms between writing dirty blocks to mem */
-#define UPDATE_ACCESS_MS 1 /* ms between updating access bits. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+#define READ_AHEAD_QUEUE 128 /* Max read-ahead requests waiting at once. */
+#define READ_AHEAD_RUN_MAX 16 /* Most sectors read ahead in one transfer. */
+#define READ_AHEAD_WORKERS 4 /* Threads servicing read-ahead requests. */
+#define REFRESH_CACHE_MS 100 /* Default ms between flushes of dirty blocks. */
+#define DIRTY_HIGH_PCT 50 /* Default dirty percentage that triggers a flush. */
+#define FLUSH_RUN_MAX 64 /* Most adjacent sectors written in one transfer. */
+#define CLOCK_MAX 3 /* Most passes of the clock hand a block can survive. */
+#define NO_SECTOR ((block_sector_t) -1) /* Sector of a dropped block. */
 
 
-/* Cache of file blocks */
-struct cache_block buffer[CACHE_BLOCKS];
+/* Cache of file blocks, allocated at boot. */
+static struct cache_block *buffer;
+/* Number of blocks in buffer. */
+static size_t cache_size;
 
-/* Used by read ahead thread to know if reading ahead required. */
-bool read_ahead;
-/* Block to read ahead. */
-block_sector_t next_block;
+/* Next block the clock hand will look at.  Protected by cache_lock. */
+static size_t clock_hand;
+
+/* Index of the valid blocks in buffer, keyed by sector. */
+static struct hash cache_index;
+/* Blocks that have never held a sector. */
+static struct list free_blocks;
+/* Protects cache_index, free_blocks and the sector of every block. */
+static struct lock cache_lock;
+
+/* Tunables, settable from the kernel command line. */
+unsigned cache_flush_ms = REFRESH_CACHE_MS;
+unsigned cache_dirty_pct = DIRTY_HIGH_PCT;
+
+/* Blocks written since they were last written back, in no particular order.
+ * A block is on the list exactly when its dirty flag is set. */
+static struct list dirty_blocks;
+/* Number of blocks on dirty_blocks, and how many of them are metadata. */
+static size_t dirty_cnt, meta_cnt;
+/* dirty_cnt at which writers start flushing. */
+static size_t dirty_high;
+/* Protects dirty_blocks, dirty_cnt, meta_cnt and the dirty and meta flags of
+ * every block. */
+static struct lock dirty_lock;
+/* Held while flushing, so that only one thread flushes at a time. */
+static struct lock flush_lock;
+/* Snapshot of dirty_blocks taken by the flusher, cache_size entries. */
+static struct cache_block **flush_batch;
+/* Disk requests for the runs in flush_batch, the one for a run starting at
+ * flush_batch[i] being flush_reqs[i] with flush_data + i as its buffers. */
+static struct block_request *flush_reqs;
+static void **flush_data;
+/* Up'd as each run finishes writing. */
+static struct semaphore flush_done;
+
+/* Statistics. */
+static unsigned long long lookup_cnt; /* Calls to find_block. */
+static unsigned long long miss_cnt; /* Lookups that had to go to disk. */
+static unsigned long long ra_load_cnt; /* Blocks loaded by read-ahead. */
+static unsigned long long ra_unused_cnt; /* ...then evicted before use. */
+static unsigned long long flush_sector_cnt; /* Sectors written by flushes. */
+static unsigned long long flush_run_cnt; /* Transfers they took. */
+static unsigned long long evict_dirty_cnt; /* Evictions that had to write. */
+static unsigned long long direct_read_cnt; /* Sectors read around the cache. */
+static unsigned long long direct_write_cnt; /* ...and written around it. */
+static unsigned long long new_cnt; /* Blocks zeroed instead of read. */
+
+/* A run of consecutive sectors to read ahead. */
+struct ra_request {
+    block_sector_t sector;
+    block_sector_t cnt;
+};
+
+/* Runs waiting to be read ahead, a ring buffer of READ_AHEAD_QUEUE entries
+ * starting at ra_head.  Requests that arrive while it is full are dropped;
+ * read-ahead is only a hint. */
+static struct ra_request ra_queue[READ_AHEAD_QUEUE];
+static size_t ra_head;
+static size_t ra_cnt;
+/* Protects ra_queue, ra_head and ra_cnt. */
+static struct lock ra_lock;
+/* Blocks the read-ahead workers hold claimed and locked between them, and
+ * the most they may, so that misses always find something to evict.  Both
+ * are protected by cache_lock. */
+static size_t ra_held, ra_held_max;
+/* Counts the requests in ra_queue; read-ahead workers wait on it. */
+static struct semaphore ra_pending;
 
 /* Periodically refreshes cache. */
 void refresh_cache_cycle(void *aux UNUSED);
-/* Updates last access value for every block in cache. */
-void update_accesses(void *aux UNUSED);
 /* Chooses a block to evict from the cache and evicts it. */
 struct cache_block *cache_evict(void);
 /* Finds the block in the cache. */
 struct cache_block *find_block(block_sector_t sector);
-/* Implemented to read next block from disk on block read. */
-void cache_read_ahead(void *args);
+/* Finds the block holding sector in the index. */
+static struct cache_block *cache_lookup(block_sector_t sector);
+static unsigned cache_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool cache_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED);
+/* Claims a block for sector without reading it in. */
+static struct cache_block *cache_claim(block_sector_t sector, bool may_fail);
+/* Claims a block for sector and reads it in. */
+static struct cache_block *cache_load(block_sector_t sector);
+/* Reads claimed blocks for consecutive sectors in as read-ahead. */
+static void cache_read_ahead_fill(struct cache_block **run, size_t cnt);
+/* Services read-ahead requests from ra_queue. */
+static void cache_read_ahead_worker(void *aux UNUSED);
+static bool cache_copy_out(block_sector_t sector, void *buffer);
+static bool cache_drop(block_sector_t sector, const void *buffer);
+static void cache_copy_in(block_sector_t sector, const void *buffer);
+static size_t cache_min_blocks(void);
 
 void cache_read_begin(struct cache_block *cache_block);
 void cache_write_begin(struct cache_block *cache_block);
@@ -58,36 +144,92 @@ bool cache_read_try(struct cache_block *cache_block);
 bool cache_write_try(struct cache_block *cache_block);
 void cache_upgrade(struct cache_block *cache_block);
 void cache_downgrade(struct cache_block *cache_block);
+static void cache_write_release(struct cache_block *cache_block);
+static void cache_mark_dirty(struct cache_block *cache_block, bool meta);
+static void cache_write_finish(struct cache_block *cache_block);
+static void cache_mark_clean(struct cache_block *cache_block);
+static void cache_flush(void);
+static size_t cache_write_runs(size_t lo, size_t hi, bool locked);
+static void cache_write_run(size_t first, size_t cnt);
+static void cache_write_run_done(struct block_request *request);
+static int cache_sector_cmp(const void *a, const void *b);
 
 /*!
  * init_cache
  * 
  * @descr Initializes the file cache.
+ * 
+ * @param block_cnt - Number of sectors the cache holds.
  */
-void cache_init(void) {
-    
-    read_ahead = 0;
+void cache_init(size_t block_cnt) {
+    size_t i;
     
-    int i;
-    for (i = 0; i < CACHE_BLOCKS; i++) {    
+    lock_init(&cache_lock);
+    lock_init(&ra_lock);
+    lock_init(&dirty_lock);
+    lock_init(&flush_lock);
+    sema_init(&ra_pending, 0);
+    list_init(&free_blocks);
+    list_init(&dirty_blocks);
+    if (!hash_init(&cache_index, cache_hash, cache_less, NULL))
+        PANIC("Failed to allocate buffer cache index");
+
+    /* The metadata of an operation and the whole free map must fit in the
+     * part of the cache that metadata may pin, see cache_meta_fits(). */
+    if (block_cnt < cache_min_blocks()) {
+        block_cnt = cache_min_blocks();
+        printf("Buffer cache raised to %zu blocks to journal %s.\n",
+               block_cnt, block_name(fs_device));
+    }
+
+    /* Block descriptors come from the heap, the data itself straight from
+     * the page allocator, SECTORS_PER_PAGE blocks to a page. */
+    cache_size = block_cnt;
+    ra_held_max = cache_size / 8 > 0 ? cache_size / 8 : 1;
+    buffer = calloc(cache_size, sizeof *buffer);
+    if (buffer == NULL)
+        PANIC("Failed to allocate %zu buffer cache descriptors", cache_size);
+    flush_batch = malloc(cache_size * sizeof *flush_batch);
+    flush_reqs = malloc(cache_size * sizeof *flush_reqs);
+    flush_data = malloc(cache_size * sizeof *flush_data);
+    if (flush_batch == NULL || flush_reqs == NULL || flush_data == NULL)
+        PANIC("Failed to allocate buffer cache flush list");
+    sema_init(&flush_done, 0);
+    if (cache_flush_ms == 0)
+        cache_flush_ms = 1;
+    dirty_high = cache_size * cache_dirty_pct / 100;
+    if (dirty_high == 0)
+        dirty_high = 1;
+    for (i = 0; i < cache_size; i += SECTORS_PER_PAGE) {
+        char *page = palloc_get_page(0);
+        size_t j;
+        if (page == NULL)
+            PANIC("Out of kernel pages for a %zu block buffer cache",
+                  cache_size);
+        for (j = 0; j < SECTORS_PER_PAGE && i + j < cache_size; j++)
+            buffer[i + j].data = page + j * BLOCK_SECTOR_SIZE;
+    }
+
+    for (i = 0; i < cache_size; i++) {    
         buffer[i].valid = false;
         buffer[i].sector = 0;
+        list_push_back(&free_blocks, &buffer[i].block_elem);
 
         /* Initialize lock. */
-        sema_init(&buffer[i].lock.g, 1);
         lock_init(&buffer[i].lock.r);
-        lock_init(&buffer[i].lock.extra);
+        cond_init(&buffer[i].lock.c);
         buffer[i].lock.b = 0;
-        
+        buffer[i].lock.w = false;
     }
     
-    /* Devote threads to refreshing cache (write dirty blocks to memory) and
-     * updating accessed bits. */
+    /* Devote a thread to refreshing cache (write dirty blocks to disk). */
     thread_create("cache_refresh", PRI_DEFAULT, refresh_cache_cycle, NULL);
-    thread_create("cache_accesses", PRI_DEFAULT, update_accesses, NULL);
     
-    /* Takes care of reading ahead if there is reading ahead to be done. */
-    thread_create("cache_read_ahead", PRI_DEFAULT, cache_read_ahead, NULL);
+    /* A few threads sleep until there is reading ahead to be done, so that
+     * several sequential readers can have prefetches in flight at once. */
+    for (i = 0; i < READ_AHEAD_WORKERS; i++)
+        thread_create("cache_read_ahead", PRI_DEFAULT,
+                      cache_read_ahead_worker, NULL);
 }
 
 /*!
@@ -101,7 +243,7 @@ void cache_init(void) {
  * @return cache_block - Pointer to the cache block read from.
  */
 struct cache_block *cache_read_block(block_sector_t sector) {
-    /* find_block sets accessed bit */
+    /* find_block counts the reference */
     struct cache_block *cache_block = find_block(sector);
     
     return cache_block;
@@ -109,16 +251,11 @@ struct cache_block *cache_read_block(block_sector_t sector) {
 
 /** Acquires a read lock on the cache block. **/
 void cache_read_begin(struct cache_block *cache_block) {
-    /* Reading from block.  Want to increment b to mark that there is an access
-     * and if the lock is not held by anyone, acquire it to ensure nothing
-     * writes to this block while reading. */
-    lock_acquire(&cache_block->lock.r); // Ensure this is atomic
+    /* Readers share the block; only wait while a writer holds it. */
+    lock_acquire(&cache_block->lock.r);
+    while (cache_block->lock.w)
+        cond_wait(&cache_block->lock.c, &cache_block->lock.r);
     cache_block->lock.b += 1;
-    if (cache_block->lock.b == 1) { // Only accessor, lock is free
-        lock_acquire(&cache_block->lock.extra);
-        sema_down(&cache_block->lock.g);
-        lock_release(&cache_block->lock.extra);
-    }
     lock_release(&cache_block->lock.r);
 }
 
@@ -126,32 +263,280 @@ void cache_read_begin(struct cache_block *cache_block) {
 bool cache_read_try(struct cache_block *cache_block) {
     if (!lock_try_acquire(&cache_block->lock.r)) return false;
     
-    cache_block->lock.b += 1;
-    if (cache_block->lock.b == 1) {
-        if (!sema_try_down(&cache_block->lock.g)) {
-            cache_block->lock.b -= 1;
-            lock_release(&cache_block->lock.r);
-            return false;
-        }
-    }
+    bool success = !cache_block->lock.w;
+    if (success)
+        cache_block->lock.b += 1;
     lock_release(&cache_block->lock.r);
-    return true;
+    return success;
 }
 
 /*!
  * cache_read_ahead
  * 
- * @descr Used to read the next block into the cache.  This should be run on
- *        a thread of its own while the first block is still being read.
+ * @descr Asks for the cnt sectors starting at sector to be brought into the
+ *        cache in the background.  Returns immediately.  Sectors already
+ *        cached are left alone, and the request is dropped if too many are
+ *        already waiting.
+ * 
+ * @param sector - First sector in disk to prefetch.
+ * @param cnt - Number of consecutive sectors to prefetch.
+ */
+void cache_read_ahead(block_sector_t sector, block_sector_t cnt) {
+    ASSERT(cnt > 0);
+    ASSERT(sector < block_size(fs_device));
+    ASSERT(cnt <= block_size(fs_device) - sector);
+
+    lock_acquire(&ra_lock);
+    if (ra_cnt < READ_AHEAD_QUEUE) {
+        struct ra_request *r = &ra_queue[(ra_head + ra_cnt) % READ_AHEAD_QUEUE];
+        r->sector = sector;
+        r->cnt = cnt;
+        ra_cnt++;
+        sema_up(&ra_pending);
+    }
+    lock_release(&ra_lock);
+}
+
+/*!
+ * cache_read_ahead_worker
+ * 
+ * @descr Sleeps until a read-ahead request is queued, then loads the sectors
+ *        that are not in the cache, reading each stretch of them with one
+ *        transfer.  Sectors that are already cached are flagged as read
+ *        ahead so that the reader still counts them when it gets there.
+ *        A stretch also ends when the workers hold ra_held_max blocks
+ *        between them or nothing can be evicted, since read-ahead must
+ *        never leave a reader without a block.
+ */
+static void cache_read_ahead_worker(void *aux UNUSED) {
+    struct cache_block *run[READ_AHEAD_RUN_MAX];
+    struct ra_request r;
+    struct cache_block *cache_block;
+    size_t n, i;
+
+    while (1) {
+        sema_down(&ra_pending);
+        lock_acquire(&ra_lock);
+        r = ra_queue[ra_head];
+        ra_head = (ra_head + 1) % READ_AHEAD_QUEUE;
+        ra_cnt--;
+        lock_release(&ra_lock);
+
+        n = 0;
+        for (i = 0; i < r.cnt; i++) {
+            lock_acquire(&cache_lock);
+            cache_block = cache_lookup(r.sector + i);
+            if (cache_block != NULL) {
+                cache_block->prefetched = true;
+                lock_release(&cache_lock);
+                cache_block = NULL;
+            } else if (ra_held >= ra_held_max) {
+                lock_release(&cache_lock);
+            } else {
+                cache_block = cache_claim(r.sector + i, true);
+                if (cache_block != NULL)
+                    ra_held++;
+            }
+
+            /* A sector we could not claim ends the stretch. */
+            if (cache_block == NULL) {
+                cache_read_ahead_fill(run, n);
+                n = 0;
+                continue;
+            }
+            run[n++] = cache_block;
+            if (n == READ_AHEAD_RUN_MAX) {
+                cache_read_ahead_fill(run, n);
+                n = 0;
+            }
+        }
+        cache_read_ahead_fill(run, n);
+    }
+}
+
+/* Reads the cnt claimed, write-locked blocks in run, which hold consecutive
+ * sectors, in from disk with one transfer and releases them. */
+static void cache_read_ahead_fill(struct cache_block **run, size_t cnt) {
+    void *data[READ_AHEAD_RUN_MAX];
+    size_t i;
+
+    if (cnt == 0)
+        return;
+    ASSERT(cnt <= READ_AHEAD_RUN_MAX);
+    for (i = 0; i < cnt; i++)
+        data[i] = run[i]->data;
+    block_read_vector(fs_device, run[0]->sector, data, cnt);
+
+    for (i = 0; i < cnt; i++) {
+        /* Count it as referenced once so that it survives a pass of the
+         * clock hand before the reader gets to it. */
+        run[i]->clock = 1;
+        run[i]->prefetched = true;
+        ra_load_cnt++;
+        cache_write_release(run[i]);
+    }
+
+    lock_acquire(&cache_lock);
+    ra_held -= cnt;
+    lock_release(&cache_lock);
+}
+
+/*!
+ * cache_take_prefetched
+ * 
+ * @descr Tells a reader holding a lock on cache_block whether it got there
+ *        because of a read-ahead, and clears that state.
+ * 
+ * @return true if the block was read ahead and nobody had read it since.
+ */
+bool cache_take_prefetched(struct cache_block *cache_block) {
+    bool prefetched = cache_block->prefetched;
+    cache_block->prefetched = false;
+    return prefetched;
+}
+
+/*!
+ * cache_read_direct
+ * 
+ * @descr Reads the cnt consecutive sectors starting at sector into buffers,
+ *        one sector apiece, copying the ones that are cached out of the cache
+ *        and reading each stretch of the others from disk with one transfer,
+ *        without bringing them into the cache.  A sector that is not cached
+ *        has no newer copy than the one on disk, since dirty blocks stay in
+ *        the cache until they are written back.
+ * 
+ * @param sector - First sector in disk to read.
+ * @param cnt - Number of consecutive sectors to read.
+ * @param buffers - Where to put each sector, in kernel memory.
+ */
+void cache_read_direct(block_sector_t sector, block_sector_t cnt,
+                       void *const buffers[]) {
+    block_sector_t first = 0, i;
+
+    for (i = 0; i < cnt; i++) {
+        if (cache_copy_out(sector + i, buffers[i])) {
+            block_read_vector(fs_device, sector + first, buffers + first,
+                              i - first);
+            direct_read_cnt += i - first;
+            first = i + 1;
+        }
+    }
+    block_read_vector(fs_device, sector + first, buffers + first, cnt - first);
+    direct_read_cnt += cnt - first;
+}
+
+/*!
+ * cache_write_direct
+ * 
+ * @descr Writes the cnt consecutive sectors starting at sector from buffers,
+ *        one sector apiece, straight to disk, a stretch at a time.  Cached
+ *        copies of the sectors are dropped first, so that nothing writes
+ *        back or evicts their old contents over the new ones, and nothing
+ *        has to stay locked during the write.  Copies loaded again while it
+ *        is under way get the new data once it is on disk.  Sectors held
+ *        dirty for the journal are only written into the cache, to keep
+ *        their place in line, and end a stretch.
+ * 
+ * @param sector - First sector in disk to write.
+ * @param cnt - Number of consecutive sectors to write.
+ * @param buffers - Where to take each sector from, in kernel memory.
  */
-void cache_read_ahead(void *aux UNUSED) {
-    while(1) {
-        if (read_ahead) {
-            /* Mark that we have read ahead. */
-            find_block(next_block);
-            read_ahead = 0;            
+void cache_write_direct(block_sector_t sector, block_sector_t cnt,
+                        const void *const buffers[]) {
+    block_sector_t first = 0, i;
+
+    for (i = 0; i < cnt; i++) {
+        if (cache_drop(sector + i, buffers[i])) {
+            block_write_vector(fs_device, sector + first, buffers + first,
+                               i - first);
+            direct_write_cnt += i - first;
+            first = i + 1;
         }
     }
+    block_write_vector(fs_device, sector + first, buffers + first,
+                       cnt - first);
+    direct_write_cnt += cnt - first;
+
+    /* Copies loaded while the stretch was being written may have read the
+     * old contents. */
+    for (i = 0; i < cnt; i++)
+        cache_copy_in(sector + i, buffers[i]);
+}
+
+/* Copies sector out of the cache into buffer and returns true if it is
+ * cached, otherwise returns false. */
+static bool cache_copy_out(block_sector_t sector, void *buffer) {
+    struct cache_block *cache_block;
+    bool cached;
+
+    lock_acquire(&cache_lock);
+    cache_block = cache_lookup(sector);
+    lock_release(&cache_lock);
+    if (cache_block == NULL)
+        return false;
+
+    /* It may have been evicted while we waited for the lock. */
+    cache_read_begin(cache_block);
+    cached = cache_block->sector == sector;
+    if (cached)
+        memcpy(buffer, cache_block->data, BLOCK_SECTOR_SIZE);
+    cache_read_end(cache_block);
+    return cached;
+}
+
+/* Drops sector from the cache before buffer is written over it on disk.  A
+ * copy the journal has yet to write gets buffer's contents instead and is
+ * left dirty, and true is returned; otherwise returns false. */
+static bool cache_drop(block_sector_t sector, const void *buffer) {
+    struct cache_block *cache_block;
+
+    lock_acquire(&cache_lock);
+    cache_block = cache_lookup(sector);
+    lock_release(&cache_lock);
+    if (cache_block == NULL)
+        return false;
+
+    /* It may have been evicted while we waited for the lock. */
+    cache_write_begin(cache_block);
+    if (cache_block->sector != sector) {
+        cache_write_release(cache_block);
+        return false;
+    }
+    if (cache_block->dirty && cache_block->meta) {
+        memcpy(cache_block->data, buffer, BLOCK_SECTOR_SIZE);
+        cache_write_end(cache_block);
+        return true;
+    }
+
+    /* Anyone still waiting for the block finds it holds no sector. */
+    cache_mark_clean(cache_block);
+    lock_acquire(&cache_lock);
+    hash_delete(&cache_index, &cache_block->hash_elem);
+    cache_block->sector = NO_SECTOR;
+    cache_block->valid = false;
+    list_push_back(&free_blocks, &cache_block->block_elem);
+    lock_release(&cache_lock);
+    cache_write_release(cache_block);
+    return false;
+}
+
+/* Copies buffer, just written to disk, over a clean copy of sector loaded
+ * into the cache before the write finished.  Dirty copies hold newer data
+ * and are left alone. */
+static void cache_copy_in(block_sector_t sector, const void *buffer) {
+    struct cache_block *cache_block;
+
+    lock_acquire(&cache_lock);
+    cache_block = cache_lookup(sector);
+    lock_release(&cache_lock);
+    if (cache_block == NULL)
+        return;
+
+    /* It may have been evicted while we waited for the lock. */
+    cache_write_begin(cache_block);
+    if (cache_block->sector == sector && !cache_block->dirty)
+        memcpy(cache_block->data, buffer, BLOCK_SECTOR_SIZE);
+    cache_write_release(cache_block);
 }
 
 /*!
@@ -164,57 +549,223 @@ void cache_read_ahead(void *aux UNUSED) {
  */
 
 struct cache_block *cache_write_block(block_sector_t sector) {
-    /* Find a space for/a pointer to the block in the cache. */
-    struct cache_block *cache_block = find_block(sector);
-    cache_upgrade(cache_block); 
+    while (true) {
+        /* Find a space for/a pointer to the block in the cache. */
+        struct cache_block *cache_block = find_block(sector);
+        cache_upgrade(cache_block); 
+
+        /* The upgrade is not atomic, so the block may have been evicted
+         * and reused in between.  If so, start over. */
+        if (cache_block->sector == sector)
+            return cache_block;
+        cache_write_release(cache_block);
+    }
+}
+
+/*!
+ * cache_write_new
+ * 
+ * @descr Writes to a block in the cache for a sector that was just allocated,
+ *        whose old contents don't matter.  The block is zeroed instead of read
+ *        in from disk, replacing whatever was cached for the sector, so that a
+ *        new block costs no I/O until it is written back.
+ * 
+ * @param sector - The sector on disk to write to
+ * 
+ * @return cache_block - The block, write locked and zeroed.
+ */
+struct cache_block *cache_write_new(block_sector_t sector) {
+    struct cache_block *cache_block = NULL;
+
+    ASSERT(sector < block_size(fs_device));
+    while (cache_block == NULL) {
+        lock_acquire(&cache_lock);
+        cache_block = cache_lookup(sector);
+        if (cache_block == NULL) {
+            cache_block = cache_claim(sector, false);
+            continue;
+        }
+        lock_release(&cache_lock);
+        cache_write_begin(cache_block);
+
+        /* It may have been evicted while we waited for the lock. */
+        if (cache_block->sector != sector) {
+            cache_write_release(cache_block);
+            cache_block = NULL;
+        }
+    }
+    new_cnt++;
+
+    if (cache_block->clock < CLOCK_MAX)
+        cache_block->clock++;
+    cache_block->prefetched = false;
+    memset(cache_block->data, 0, BLOCK_SECTOR_SIZE);
     return cache_block;
 }
 
 /** Acquires a write lock on the block. **/
 void cache_write_begin(struct cache_block *cache_block) {
     /* Must have a lock before writing to cache. */
-    lock_acquire(&cache_block->lock.extra);
-    sema_down(&cache_block->lock.g);
-    lock_release(&cache_block->lock.extra);
+    lock_acquire(&cache_block->lock.r);
+    while (cache_block->lock.w || cache_block->lock.b > 0)
+        cond_wait(&cache_block->lock.c, &cache_block->lock.r);
+    cache_block->lock.w = true;
+    lock_release(&cache_block->lock.r);
 }
 
 /** Tries to acquire a write lock. Return true if successful. */
 bool cache_write_try(struct cache_block *cache_block) {
     /* Must have a lock before writing to cache. */
-    return sema_try_down(&cache_block->lock.g);
+    if (!lock_try_acquire(&cache_block->lock.r)) return false;
+
+    bool success = !cache_block->lock.w && cache_block->lock.b == 0;
+    if (success)
+        cache_block->lock.w = true;
+    lock_release(&cache_block->lock.r);
+    return success;
 }
 
-/** Atomically upgrades from holding a read lock to holding a 
- * write lock. Must be holding a read lock before calling. */
+/** Upgrades from holding a read lock to holding a write lock. Must be
+ * holding a read lock before calling.  The read lock is dropped while
+ * waiting, so other writers may get in first. */
 void cache_upgrade(struct cache_block *cache_block) {
     lock_acquire(&cache_block->lock.r); // Ensure this is atomic
     cache_block->lock.b -= 1;
-    if (cache_block->lock.b == 0) {
-        lock_release(&cache_block->lock.r);
-        return;
-    } else {
-        lock_acquire(&cache_block->lock.extra);
-        lock_release(&cache_block->lock.r);
-        sema_down(&cache_block->lock.g);
-        lock_release(&cache_block->lock.extra);
-        return;
-    }
+    while (cache_block->lock.w || cache_block->lock.b > 0)
+        cond_wait(&cache_block->lock.c, &cache_block->lock.r);
+    cache_block->lock.w = true;
+    lock_release(&cache_block->lock.r);
 }
 
 /** Atomically downgrades from holding a write lock to holding a 
  * read lock. */
 void cache_downgrade(struct cache_block *cache_block) {
     lock_acquire(&cache_block->lock.r); // Ensure this is atomic
-    ASSERT(cache_block->lock.b == 0);
+    ASSERT(cache_block->lock.w && cache_block->lock.b == 0);
+    cache_block->lock.w = false;
     cache_block->lock.b += 1;
+    cond_broadcast(&cache_block->lock.c, &cache_block->lock.r);
     lock_release(&cache_block->lock.r);    
 }
 
+/* Hashes a cache block by the sector it holds. */
+static unsigned cache_hash(const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int((int) hash_entry(e, struct cache_block, hash_elem)->sector);
+}
+
+/* Orders cache blocks by the sector they hold. */
+static bool cache_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED) {
+    return hash_entry(a, struct cache_block, hash_elem)->sector <
+        hash_entry(b, struct cache_block, hash_elem)->sector;
+}
+
+/* Returns the block holding sector, or NULL if it is not cached.
+ * Caller must hold cache_lock. */
+static struct cache_block *cache_lookup(block_sector_t sector) {
+    struct cache_block key;
+    struct hash_elem *e;
+
+    ASSERT(lock_held_by_current_thread(&cache_lock));
+    key.sector = sector;
+    e = hash_find(&cache_index, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct cache_block, hash_elem) : NULL;
+}
+
+/*!
+ * cache_claim
+ * 
+ * @descr Claims a block for sector, evicting one if necessary, and indexes it
+ *        under sector, but leaves reading the sector in to the caller.  Must
+ *        be called with cache_lock held; releases it.
+ * 
+ * @param sector - Sector in disk to claim a block for.
+ * @param may_fail - Return NULL rather than panic if no block can be
+ *        evicted, for read-ahead, which can do without.
+ * 
+ * @return cache_block - The block, write locked, or NULL if another thread
+ *         got the sector into the cache first.
+ */
+static struct cache_block *cache_claim(block_sector_t sector, bool may_fail) {
+    struct cache_block *cache_block;
+
+    ASSERT(lock_held_by_current_thread(&cache_lock));
+
+    /* Take a block that has never been used if there is one, otherwise
+     * evict.  Either way we come back holding its write lock. */
+    if (!list_empty(&free_blocks)) {
+        cache_block = list_entry(list_pop_front(&free_blocks),
+                                 struct cache_block, block_elem);
+        cache_write_begin(cache_block);
+    } else {
+        cache_block = cache_evict();
+        if (cache_block == NULL) {
+            if (!may_fail)
+                PANIC("Cache is full and completely locked down!\n");
+            lock_release(&cache_lock);
+            return NULL;
+        }
+        if (cache_block->dirty) {
+            /* Write back without holding up the rest of the cache.  The
+             * block stays indexed under its old sector until then, so
+             * nobody can read a stale copy from disk meanwhile. */
+            lock_release(&cache_lock);
+            block_write(fs_device, cache_block->sector,
+                        (uint8_t *) cache_block->data);
+            cache_mark_clean(cache_block);
+            evict_dirty_cnt++;
+            lock_acquire(&cache_lock);
+
+            /* Someone else may have loaded the sector meanwhile. */
+            if (cache_lookup(sector) != NULL) {
+                lock_release(&cache_lock);
+                cache_write_release(cache_block);
+                return NULL;
+            }
+        }
+        hash_delete(&cache_index, &cache_block->hash_elem);
+    }
+
+    /* Claim the sector so that concurrent lookups wait on our lock
+     * instead of loading it a second time. */
+    cache_block->sector = sector;
+    cache_block->valid = true;
+    hash_insert(&cache_index, &cache_block->hash_elem);
+    lock_release(&cache_lock);
+
+    /* Caller will set these accordingly, but should start cleared. */
+    cache_block->clock = 0;
+    cache_block->prefetched = false;
+    return cache_block;
+}
+
+/*!
+ * cache_load
+ * 
+ * @descr Claims a block for sector, evicting one if necessary, and reads the
+ *        sector into it.  Must be called with cache_lock held; releases it.
+ * 
+ * @param sector - Sector in disk to load.
+ * 
+ * @return cache_block - The block, write locked, or NULL if another thread
+ *         got the sector into the cache first.
+ */
+static struct cache_block *cache_load(block_sector_t sector) {
+    struct cache_block *cache_block = cache_claim(sector, false);
+
+    /* Import block. */
+    if (cache_block != NULL) {
+        block_read(fs_device, sector, (uint8_t *) cache_block->data);
+        miss_cnt++;
+    }
+    return cache_block;
+}
+
 /*!
  * find_block
  * 
  * @descr Finds the block in the cache, or loads it into the cache, evicting
- *        a block if necessary.
+ *        a block if necessary.  Returns with a read lock held on the block.
  * 
  * @param sector - Sector in disk associated with memory access.
  * 
@@ -228,97 +779,96 @@ struct cache_block *find_block(block_sector_t sector) {
     /* Don't attempt to access block outside of device. */
     ASSERT(sector < block_size(fs_device));
     
-    int i;
-    for (i = 0; i < CACHE_BLOCKS; i++) {  
-        /* If this is a match, stop iterating. */
-        if (buffer[i].sector == sector) {
-            cache_read_begin(buffer+i);
-            ASSERT(buffer[i].sector == sector);
-            cache_block = buffer + i;
-            break;
-        }
-    }
-    
-    if (cache_block == NULL) {
-        // See if there is free space
-        for (i = 0; i < CACHE_BLOCKS; i++) {    
-            if (!cache_write_try(buffer+i)) continue;
-            if (!buffer[i].valid) {
-                cache_block = buffer + i;
-                cache_block->valid = true;
-                break;
+    while (cache_block == NULL) {
+        lock_acquire(&cache_lock);
+        cache_block = cache_lookup(sector);
+        if (cache_block != NULL) {
+            lock_release(&cache_lock);
+            cache_read_begin(cache_block);
+
+            /* It may have been evicted while we waited for the lock. */
+            if (cache_block->sector != sector) {
+                cache_read_end(cache_block);
+                cache_block = NULL;
             }
-            cache_write_end(buffer+i);
+            continue;
         }
-        
-        /* Need to evict.  Retain space from eviction. */
-        if (cache_block == NULL) {
-            cache_block = cache_evict();
-        }        
-            
-        /* Import block. */
-        block_read(fs_device, sector, (uint8_t *) cache_block->data);
-        cache_block->sector = sector;
-        
-        /* Caller will set these accordingly, but should start cleared. */
-        cache_block->dirty = 0;
-        cache_block->recent_accesses = 0;
 
-        cache_downgrade(cache_block); 
+        cache_block = cache_load(sector);
+        if (cache_block != NULL)
+            cache_downgrade(cache_block); 
     }
+    lookup_cnt++;
     
-    /* While read happens, load next block from disk into cache. */
-    /* This is done on its own thread so it happens in the background. */
-    next_block = sector + 1;
-    read_ahead = 1;
-    
-    /* Only entering this function if an access is being made. */
-    cache_block->accessed = 1;
-    /* Update recent_access so we don't accidentally immediately evict this */
-    cache_block->recent_accesses |= ((uint64_t) 1 << 63);
+    /* Only entering this function if an access is being made.  A block read
+     * once, as in a long sequential scan, gets a count of one and goes on the
+     * next pass of the hand; blocks used over and over build up to CLOCK_MAX
+     * and outlast the scan. */
+    if (cache_block->clock < CLOCK_MAX)
+        cache_block->clock++;
     return cache_block;
 }
 
 /*!
  * cache_evict
  * 
- * @descr Finds the block in the cache whose last access is in the most distant
- *        past, then evicts it from the cache.
+ * @descr Runs the clock hand around the cache until it finds an unlocked
+ *        block whose reference count has run out, taking one off the count of
+ *        every other unlocked block it passes, and returns the block write
+ *        locked.  Dirty blocks are passed over while a clean one can be found
+ *        within one more turn of the hand, so that a miss only has to wait
+ *        for a write when there is nothing else.  Metadata waiting for the
+ *        journal is never taken, since writing it in place before it is
+ *        committed could leave half an operation on disk.  The caller must
+ *        hold cache_lock and is responsible for writing the block back if it
+ *        is dirty.  Returns NULL if every block is locked or waiting for the
+ *        journal.
  */
 struct cache_block *cache_evict(void) {
-    int i;
-    
-    /* Block to evict. */
-    struct cache_block *victim = NULL;
+    /* Block to evict, and the first dirty candidate seen. */
+    struct cache_block *victim = NULL, *dirty = NULL;
     struct cache_block *temp;
-    uint64_t oldest = ~0;
-    for(i = 0; i < CACHE_BLOCKS; i++) {
-        if (!cache_write_try(buffer+i)) continue;
+    size_t scanned, since_dirty = 0;
+    bool journaled = journal_enabled();
 
-        /* Get next eviction candidate. */
-        temp = buffer + i;
+    ASSERT(lock_held_by_current_thread(&cache_lock));
+
+    /* Every block's count reaches zero within CLOCK_MAX + 1 turns, and one
+     * more turn covers the search for a clean block. */
+    for (scanned = 0; scanned < cache_size * (CLOCK_MAX + 2); scanned++) {
+        if (dirty != NULL && ++since_dirty > cache_size)
+            break;
+        temp = buffer + clock_hand;
+        clock_hand = (clock_hand + 1) % cache_size;
+        if (!cache_write_try(temp)) continue;
         ASSERT(temp->valid);
-        /* Checking <= oldest because if every block has been accessed every
-         * clock for the past 64 clocks, then this would otherwise fail to
-         * return a victim when indeed there was a victim. */
 
-        if (temp->recent_accesses <= oldest) {
-            if (victim) cache_write_end(victim);
-            oldest = temp->recent_accesses;
+        if (temp->clock > 0) {
+            temp->clock--;
+            cache_write_release(temp);
+        } else if (!temp->dirty) {
             victim = temp;
-            continue;
+            break;
+        } else if (temp->meta && journaled) {
+            cache_write_release(temp);
+        } else if (dirty == NULL) {
+            dirty = temp;
+        } else {
+            cache_write_release(temp);
         }
-        cache_write_end(buffer+i);
     }
 
+    /* Only settle for a dirty block if there was no clean one. */
+    if (victim == NULL)
+        victim = dirty;
+    else if (dirty != NULL)
+        cache_write_release(dirty);
+
     /* If no victim could have been chosen, don't try to remove anything. */
-    if (victim != NULL) {
-        /* If this is dirty, write it to memory before removing. */
-        if (victim->dirty)
-            block_write(fs_device, victim->sector, (uint8_t *) victim->data);
-    } else {
-        PANIC("Cache is full and completely locked down!\n");
-    }
+    if (victim == NULL)
+        return NULL;
+    if (victim->prefetched)
+        ra_unused_cnt++;
     
     /* Return the block for the caller to handle. */
     return victim;
@@ -327,26 +877,172 @@ struct cache_block *cache_evict(void) {
 /*!
  * refresh_cache
  * 
- * @descr Rewrites all dirty blocks in cache to memory.
+ * @descr Writes all dirty blocks in cache back to disk, along with the parts
+ *        of the free map changed since last time.  Blocks that are locked by
+ *        someone else are left for the next flush.
  */
 void refresh_cache(void) {
-    int i; 
-    /* Temp for writing blocks to memory. */
-    struct cache_block *blk;
-    
-    for(i = 0; i < CACHE_BLOCKS; i++) {
-        /* Get the next cache file block. */
-        blk = buffer + i;
-        if (!blk->valid) continue;
-        if (!cache_read_try(blk)) continue;
-        
-        /* Only care about writing to memory if dirty. */
-        if (blk->dirty) {
-            block_write(fs_device, blk->sector, (void *) blk->data);
-            blk->dirty = 0;
+    lock_acquire(&flush_lock);
+    cache_flush();
+    lock_release(&flush_lock);
+}
+
+/*!
+ * cache_flush
+ * 
+ * @descr Writes back the dirty list in order of sector, so that the disk head
+ *        sweeps across it once, with runs of adjacent sectors written as one
+ *        transfer.  All the runs are queued with the disk at once and waited
+ *        for at the end.
+ * 
+ *        With a journal, metadata blocks are committed through it once the
+ *        data is on disk.  A thread inside a journaled operation can't wait
+ *        for a commit, which would wait for it in turn, so it writes back
+ *        only data.  Caller must hold flush_lock.
+ */
+static void cache_flush(void) {
+    struct list_elem *e;
+    struct cache_block *b;
+    size_t cnt = 0, meta = cache_size, i, j, run_cnt;
+    bool in_op = journal_in_op();
+    bool frozen = !in_op && journal_freeze();
+
+    ASSERT(lock_held_by_current_thread(&flush_lock));
+
+    /* Under a freeze the free map is consistent with the metadata too. */
+    if (!in_op)
+        free_map_flush();
+
+    /* Snapshot the list so that writers are not held up while we sort.
+     * Data goes at the front of flush_batch, metadata at the back. */
+    lock_acquire(&dirty_lock);
+    for (e = list_begin(&dirty_blocks); e != list_end(&dirty_blocks);
+         e = list_next(e)) {
+        b = list_entry(e, struct cache_block, dirty_elem);
+        if (!b->meta || !journal_enabled())
+            flush_batch[cnt++] = b;
+        else if (frozen)
+            flush_batch[--meta] = b;
+    }
+    lock_release(&dirty_lock);
+
+    /* Sectors are read without the blocks' locks, so a block evicted and
+     * reused meanwhile may end up out of place.  That only costs a seek. */
+    qsort(flush_batch, cnt, sizeof *flush_batch, cache_sector_cmp);
+    run_cnt = cache_write_runs(0, cnt, false);
+    while (run_cnt-- > 0)
+        sema_down(&flush_done);
+
+    /* Lock the metadata for good.  No operation is running to hold it, and
+     * nobody else writes metadata, so it is what the journal should get. */
+    for (i = j = meta; i < cache_size; i++) {
+        cache_read_begin(flush_batch[i]);
+        if (flush_batch[i]->dirty && flush_batch[i]->meta)
+            flush_batch[j++] = flush_batch[i];
+        else
+            cache_read_end(flush_batch[i]);
+    }
+    qsort(flush_batch + meta, j - meta, sizeof *flush_batch,
+          cache_sector_cmp);
+
+    /* Commit it all as one transaction, then write it in place.
+     * journal_begin() keeps it from outgrowing the journal. */
+    if (j > meta) {
+        if (j - meta > JOURNAL_BLOCKS)
+            PANIC("%zu metadata blocks overflow the journal", j - meta);
+        journal_write(flush_batch + meta, j - meta);
+        run_cnt = cache_write_runs(meta, j, true);
+        while (run_cnt-- > 0)
+            sema_down(&flush_done);
+        journal_clear();
+    }
+
+    if (frozen)
+        journal_thaw();
+}
+
+/* Queues the dirty blocks in flush_batch[lo] through flush_batch[hi - 1],
+ * which are in order of sector, to be written back, with runs of adjacent
+ * sectors as one request each.  If locked is false, locks each block first,
+ * skipping blocks that are busy, already clean, or metadata that became
+ * dirty since the snapshot and has yet to be committed; otherwise the blocks
+ * are read locked and dirty already.  Returns the number of requests
+ * queued. */
+static size_t cache_write_runs(size_t lo, size_t hi, bool locked) {
+    size_t run_cnt = 0, i, j;
+    bool journaled = journal_enabled();
+
+    for (i = lo; i < hi; i = j) {
+        j = i + 1;
+        if (locked) {
+            while (j < hi && j - i < FLUSH_RUN_MAX &&
+                   flush_batch[j]->sector == flush_batch[j - 1]->sector + 1)
+                j++;
+            cache_write_run(i, j - i);
+            run_cnt++;
+            continue;
         }
-        cache_read_end(blk);
+
+        if (!cache_read_try(flush_batch[i]))
+            continue;
+        if (!flush_batch[i]->dirty || (flush_batch[i]->meta && journaled)) {
+            cache_read_end(flush_batch[i]);
+            continue;
+        }
+        while (j < hi && j - i < FLUSH_RUN_MAX &&
+               flush_batch[j]->sector == flush_batch[j - 1]->sector + 1 &&
+               cache_read_try(flush_batch[j])) {
+            if (!flush_batch[j]->dirty || (flush_batch[j]->meta && journaled) ||
+                flush_batch[j]->sector != flush_batch[j - 1]->sector + 1) {
+                cache_read_end(flush_batch[j]);
+                break;
+            }
+            j++;
+        }
+        cache_write_run(i, j - i);
+        run_cnt++;
     }
+    return run_cnt;
+}
+
+/* Queues the cnt read-locked dirty blocks starting at flush_batch[first],
+ * which hold consecutive sectors, to be written back as one request. */
+static void cache_write_run(size_t first, size_t cnt) {
+    struct block_request *request = flush_reqs + first;
+    size_t i;
+
+    ASSERT(cnt <= FLUSH_RUN_MAX);
+    for (i = 0; i < cnt; i++)
+        flush_data[first + i] = flush_batch[first + i]->data;
+    request->write = true;
+    request->sector = flush_batch[first]->sector;
+    request->cnt = cnt;
+    request->buffers = flush_data + first;
+    request->done = cache_write_run_done;
+    request->aux = flush_batch + first;
+    flush_sector_cnt += cnt;
+    flush_run_cnt++;
+    block_submit(fs_device, request);
+}
+
+/* Marks a run clean and unlocks it once it is on disk.  May run on the
+ * disk's service thread. */
+static void cache_write_run_done(struct block_request *request) {
+    struct cache_block **run = request->aux;
+    size_t i;
+
+    for (i = 0; i < request->cnt; i++) {
+        cache_mark_clean(run[i]);
+        cache_read_end(run[i]);
+    }
+    sema_up(&flush_done);
+}
+
+/* Orders pointers to cache blocks by the sector they hold. */
+static int cache_sector_cmp(const void *a, const void *b) {
+    block_sector_t x = (*(struct cache_block * const *) a)->sector;
+    block_sector_t y = (*(struct cache_block * const *) b)->sector;
+    return x < y ? -1 : x > y;
 }
 
 /*!
@@ -356,73 +1052,129 @@ void refresh_cache(void) {
  */
 void refresh_cache_cycle(void *aux UNUSED) {
     while (1) {
-        /* Write everything that's dirty back to memory. */
+        /* Write everything that's dirty back to disk. */
         refresh_cache();
         
         /* Sleep until next time we want to refresh. */
-        timer_msleep(REFRESH_CACHE_MS);
+        timer_msleep(cache_flush_ms);
     }
 }
 
-/*!
- * update_accesses
- * 
- * @descr Periodically updates the access values for all blocks in cache.  This
- *        is done by shifting right the recent_access value and or-ing in the
- *        accessed bit to the leftmost bit.  This way, larger values have been
- *        accessed more recently than others, or more frequently if their last
- *        access is the same.
- */
-void update_accesses(void *aux UNUSED) {
-    int i;
-    struct cache_block *blk;
-    
-    while (1) {
-        for (i = 0; i < CACHE_BLOCKS; i++) {
-            /* Use iterator to get next block in cache. */
-            blk = buffer + i;
-            if (!blk->valid) continue; 
-            if (!cache_read_try(blk)) continue;
-            /* Make space for access bit on left. */
-            blk->recent_accesses >>= 1;
-            
-            /* Put access bit at most significant bit.  This ensures most recently
-             * accessed blocks have largest recent access value. */
-            /*    NOTE: recent_accesses 64 bits; shifting left accordingly. */
-            blk->recent_accesses |= ((uint64_t) blk->accessed << 63);
-            
-            /* Clear the accessed bit so next time we accurately add to its access
-             * recency, but only if nothing is still accessing it. */
-            if (blk->lock.b > 0)
-                blk->accessed = 0;
-
-            cache_read_end(blk);
-        }
-        
-        /* Sleep until next time we want to update. */
-        timer_msleep(UPDATE_ACCESS_MS);
-    }
-}
-
-
 /** Releases a read lock on the block. */
 void cache_read_end(struct cache_block *cache_block) {
     
     /* Release lock and account for stopping reading from cache. */
     lock_acquire(&cache_block->lock.r);
     cache_block->lock.b -= 1;
-    if (cache_block->lock.b == 0) // Was last accesor, free lock
-        sema_up(&cache_block->lock.g);
+    if (cache_block->lock.b == 0) // Was last accesor, wake writers
+        cond_broadcast(&cache_block->lock.c, &cache_block->lock.r);
     lock_release(&cache_block->lock.r);    
 }
 
 
-/** Releases a write lock on the block and marks it dirty. */
+/** Releases a write lock on the block without marking it dirty. */
+static void cache_write_release(struct cache_block *cache_block) {
+    lock_acquire(&cache_block->lock.r);
+    ASSERT(cache_block->lock.w);
+    cache_block->lock.w = false;
+    cond_broadcast(&cache_block->lock.c, &cache_block->lock.r);
+    lock_release(&cache_block->lock.r);
+}
+
+/** Releases a write lock on the block and marks it dirty.  If too much of
+ * the cache is dirty, the writer helps flush it, unless a flush is already
+ * under way. */
 void cache_write_end(struct cache_block *cache_block) {
-    /* Done writing, free lock. */
-    sema_up(&cache_block->lock.g);
-    
     /* Mark as dirty to show that it has changed and is done changing. */
-    cache_block->dirty = 1;
+    cache_mark_dirty(cache_block, journal_in_op());
+    cache_write_finish(cache_block);
+}
+
+/** Releases a write lock on a block that holds file data and marks it dirty.
+ * Unlike cache_write_end, leaves it out of the journal even inside a
+ * journaled operation. */
+void cache_write_data_end(struct cache_block *cache_block) {
+    cache_mark_dirty(cache_block, false);
+    cache_write_finish(cache_block);
+}
+
+/** Releases a write lock on a block just marked dirty, and flushes the cache
+ * if too much of it is dirty. */
+static void cache_write_finish(struct cache_block *cache_block) {
+    /* Done writing, free lock. */
+    cache_write_release(cache_block);
+
+    if (dirty_cnt >= dirty_high && !lock_held_by_current_thread(&flush_lock)
+        && lock_try_acquire(&flush_lock)) {
+        cache_flush();
+        lock_release(&flush_lock);
+    }
+}
+
+/** Puts a block the caller holds locked on the dirty list, as metadata to be
+ * journaled if meta. */
+static void cache_mark_dirty(struct cache_block *cache_block, bool meta) {
+    lock_acquire(&dirty_lock);
+    if (meta && !cache_block->meta) {
+        cache_block->meta = true;
+        meta_cnt++;
+    }
+    if (!cache_block->dirty) {
+        cache_block->dirty = true;
+        list_push_back(&dirty_blocks, &cache_block->dirty_elem);
+        dirty_cnt++;
+    }
+    lock_release(&dirty_lock);
 }
 
+/** Takes a block the caller holds locked off the dirty list. */
+static void cache_mark_clean(struct cache_block *cache_block) {
+    lock_acquire(&dirty_lock);
+    if (cache_block->dirty) {
+        cache_block->dirty = false;
+        if (cache_block->meta)
+            meta_cnt--;
+        cache_block->meta = false;
+        list_remove(&cache_block->dirty_elem);
+        dirty_cnt--;
+    }
+    lock_release(&dirty_lock);
+}
+
+/** Returns the fewest blocks that leave room in three quarters of the cache
+ * for the free map of the file system device and one operation. */
+static size_t cache_min_blocks(void) {
+    return DIV_ROUND_UP((free_map_sector_cnt() + JOURNAL_OP_BLOCKS) * 4, 3);
+}
+
+/** Returns true if cnt more blocks of metadata can be dirtied, along with the
+ * whole free map, without overflowing the journal or tying up more than
+ * three quarters of the cache until the next commit. */
+bool cache_meta_fits(size_t cnt) {
+    size_t limit = cache_size - cache_size / 4;
+    size_t map = free_map_sector_cnt();
+    bool fits;
+
+    if (limit > JOURNAL_BLOCKS)
+        limit = JOURNAL_BLOCKS;
+    if (map + JOURNAL_OP_BLOCKS > limit)
+        PANIC("Buffer cache of %zu blocks is too small for the journal",
+              cache_size);
+    lock_acquire(&dirty_lock);
+    fits = meta_cnt + map + cnt <= limit;
+    lock_release(&dirty_lock);
+    return fits;
+}
+
+/** Prints statistics about buffer cache lookups. */
+void cache_print_stats(void) {
+    printf("Cache: %llu lookups, %llu hits, %llu misses, "
+           "%llu read ahead (%llu unused)\n",
+           lookup_cnt, lookup_cnt - miss_cnt, miss_cnt,
+           ra_load_cnt, ra_unused_cnt);
+    printf("Cache: %llu sectors flushed in %llu runs, %llu dirty evictions\n",
+           flush_sector_cnt, flush_run_cnt, evict_dirty_cnt);
+    printf("Cache: %llu sectors read and %llu written around the cache, "
+           "%llu new blocks zeroed in it\n",
+           direct_read_cnt, direct_write_cnt, new_cnt);
+}
@@ -1,10 +1,23 @@
 #ifndef BUFFER_CACHE
 #define BUFFER_CACHE
 
+#include <hash.h>
 #include <list.h>
 #include "threads/synch.h"
 #include "devices/block.h"
 
+/* Default number of sectors held by the buffer cache. */
+#define CACHE_DEFAULT_BLOCKS 64
+/* Fewest sectors -cache accepts: enough for one journaled operation and a
+ * one-sector free map in three quarters of the cache.  Larger disks need
+ * more, see cache_init(). */
+#define CACHE_MIN_BLOCKS 23
+
+/* Milliseconds between background flushes of dirty blocks (-cache-flush). */
+extern unsigned cache_flush_ms;
+/* Percentage of the cache allowed to be dirty before writers flush it
+ * themselves instead of waiting for the background flush (-cache-dirty). */
+extern unsigned cache_dirty_pct;
 
 /*!
  * rw_lock
@@ -14,11 +27,10 @@
  */
 struct rw_lock {
     struct lock r; // Lock used for atomic operations to rw_lock
-    struct semaphore g; // Lock acquired by writers to ensure mutual exclusion
+    struct condition c; // Signalled whenever the lock becomes less busy
 
-    struct lock extra; // Used for upgrades
-    
-    int b; // Number of accessors
+    int b; // Number of readers
+    bool w; // Set while a writer holds the lock
 };
 
 
@@ -30,25 +42,38 @@ struct rw_lock {
  */
 struct cache_block {
     struct list_elem block_elem; // For iterating over buffer cache
+    struct hash_elem hash_elem; // Element in the sector-keyed cache index
+    struct list_elem dirty_elem; // Element in the dirty list while dirty
     
     bool valid;
 
-    char data[BLOCK_SECTOR_SIZE]; // Data being cached
+    char *data; // Data being cached, BLOCK_SECTOR_SIZE bytes
     block_sector_t sector; // in->sector gives incomplete type
     
-    uint64_t recent_accesses; // For checking how recently this was accessed
+    uint8_t clock; // Reference count, decayed as the clock hand passes
     bool dirty; // Set if block has been written to since last write to memory
-    bool accessed; // Set if accessed since last check
+    bool meta; // Set if dirtied inside a journaled operation
+    bool prefetched; // Set if read ahead and not read by anyone since
     
     struct rw_lock lock; // Reader/writer lock
 };
 
 
-void cache_init(void); /* Initializes buffer cache. */
-void refresh_cache(void); /* Writes all dirty blocks in cache to memory. */
+void cache_init(size_t block_cnt); /* Initializes buffer cache. */
+void refresh_cache(void); /* Writes all dirty blocks in cache to disk. */
+bool cache_meta_fits(size_t cnt); /* Is there room for cnt more metadata blocks? */
 struct cache_block *cache_read_block(block_sector_t sector); /* Reads block from cache. */
 struct cache_block *cache_write_block(block_sector_t sector); /* Writes to block in cache. */
+struct cache_block *cache_write_new(block_sector_t sector); /* ...to a new, zeroed one. */
 void cache_read_end(struct cache_block *cache_block); /* Unlocks block for writing. */
+void cache_read_ahead(block_sector_t sector, block_sector_t cnt); /* Prefetches blocks in background. */
+bool cache_take_prefetched(struct cache_block *cache_block); /* Was block read ahead? */
 void cache_write_end(struct cache_block *cache_block); /* Unlocks block. */
+void cache_write_data_end(struct cache_block *cache_block); /* ...holding data. */
+void cache_read_direct(block_sector_t sector, block_sector_t cnt,
+                       void *const buffers[]); /* Reads around the cache. */
+void cache_write_direct(block_sector_t sector, block_sector_t cnt,
+                        const void *const buffers[]); /* Writes around it. */
+void cache_print_stats(void); /* Prints cache lookup statistics. */
 
 #endif // #ifndef BUFFER_CACHE
@@ -0,0 +1,210 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/synch.h"
+
+/*! Directory entry cache.
+
+    Remembers what names resolved to in which directory, so that walking a
+    path that was walked recently doesn't have to read any directory.
+    Entries are keyed by the sector of the directory's inode and the name,
+    and either give the sector of the named inode and whether it is a
+    directory, or record that the name doesn't exist.  The least recently
+    used entry makes way for a new one.
+
+    directory.c keeps the cache right: dir_lookup() fills it in, and
+    dir_add() and dir_remove() drop the entry for the name they change.
+    An empty directory still has entries cached under its sector, such as
+    ".." and names looked up and not found, so dir_remove() drops all of
+    them with dcache_invalidate_dir() when it removes a directory.  That
+    way a new directory that gets the same sector inherits nothing. */
+
+/*! A cached name. */
+struct dentry {
+    struct hash_elem hash_elem;         /*!< Element in dentry_index. */
+    struct list_elem lru_elem;          /*!< Element in dentry_lru or
+                                             dentry_free. */
+    block_sector_t parent;              /*!< Directory's inode sector. */
+    char name[NAME_MAX + 1];            /*!< Name within it. */
+    bool negative;                      /*!< Name known not to exist? */
+    block_sector_t sector;              /*!< Otherwise, its inode sector. */
+    bool is_dir;                        /*!< ...and whether a directory. */
+};
+
+static struct dentry dentries[DCACHE_SIZE];
+static struct hash dentry_index;        /*!< Entries in use. */
+static struct list dentry_lru;          /*!< ...most recently used first. */
+static struct list dentry_free;         /*!< Entries not in use. */
+static struct lock dcache_lock;         /*!< Protects all of the above. */
+
+/*! Statistics. */
+static unsigned long long lookup_cnt;   /*!< Calls to dcache_lookup(). */
+static unsigned long long hit_cnt;      /*!< ...that found an entry. */
+static unsigned long long negative_cnt; /*!< ...a negative one. */
+
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED);
+static struct dentry *dentry_find(block_sector_t parent, const char *name);
+static struct dentry *dentry_get(block_sector_t parent, const char *name);
+
+/*! Initializes the directory entry cache. */
+void dcache_init(void) {
+    size_t i;
+
+    lock_init(&dcache_lock);
+    list_init(&dentry_lru);
+    list_init(&dentry_free);
+    if (!hash_init(&dentry_index, dentry_hash, dentry_less, NULL))
+        PANIC("Failed to allocate directory entry cache index");
+    for (i = 0; i < DCACHE_SIZE; i++)
+        list_push_back(&dentry_free, &dentries[i].lru_elem);
+}
+
+/*! Looks NAME up in the directory whose inode is at PARENT.  On a hit,
+    stores the sector of its inode in *SECTOR and whether it is a directory
+    in *IS_DIR. */
+enum dcache_result dcache_lookup(block_sector_t parent, const char *name,
+                                 block_sector_t *sector, bool *is_dir) {
+    enum dcache_result result = DCACHE_MISS;
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    lookup_cnt++;
+    d = dentry_find(parent, name);
+    if (d != NULL) {
+        list_remove(&d->lru_elem);
+        list_push_front(&dentry_lru, &d->lru_elem);
+        hit_cnt++;
+        if (d->negative) {
+            negative_cnt++;
+            result = DCACHE_NEGATIVE;
+        } else {
+            *sector = d->sector;
+            *is_dir = d->is_dir;
+            result = DCACHE_HIT;
+        }
+    }
+    lock_release(&dcache_lock);
+    return result;
+}
+
+/*! Records that NAME in the directory at PARENT is the inode at SECTOR,
+    a directory if IS_DIR is true. */
+void dcache_insert(block_sector_t parent, const char *name,
+                   block_sector_t sector, bool is_dir) {
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_get(parent, name);
+    d->negative = false;
+    d->sector = sector;
+    d->is_dir = is_dir;
+    lock_release(&dcache_lock);
+}
+
+/*! Records that there is no NAME in the directory at PARENT. */
+void dcache_insert_negative(block_sector_t parent, const char *name) {
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_get(parent, name);
+    d->negative = true;
+    lock_release(&dcache_lock);
+}
+
+/*! Forgets whatever is cached about NAME in the directory at PARENT. */
+void dcache_invalidate(block_sector_t parent, const char *name) {
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    d = dentry_find(parent, name);
+    if (d != NULL) {
+        hash_delete(&dentry_index, &d->hash_elem);
+        list_remove(&d->lru_elem);
+        list_push_back(&dentry_free, &d->lru_elem);
+    }
+    lock_release(&dcache_lock);
+}
+
+/*! Forgets everything cached about names in the directory at PARENT. */
+void dcache_invalidate_dir(block_sector_t parent) {
+    struct list_elem *e, *next;
+    struct dentry *d;
+
+    lock_acquire(&dcache_lock);
+    for (e = list_begin(&dentry_lru); e != list_end(&dentry_lru); e = next) {
+        next = list_next(e);
+        d = list_entry(e, struct dentry, lru_elem);
+        if (d->parent == parent) {
+            hash_delete(&dentry_index, &d->hash_elem);
+            list_remove(&d->lru_elem);
+            list_push_back(&dentry_free, &d->lru_elem);
+        }
+    }
+    lock_release(&dcache_lock);
+}
+
+/*! Prints directory entry cache statistics. */
+void dcache_print_stats(void) {
+    printf("Dcache: %llu lookups, %llu hits (%llu negative)\n",
+           lookup_cnt, hit_cnt, negative_cnt);
+}
+
+/*! Returns the entry for NAME in PARENT, or NULL if there is none.  Must
+    be called with dcache_lock held. */
+static struct dentry *dentry_find(block_sector_t parent, const char *name) {
+    struct dentry key;
+    struct hash_elem *e;
+
+    ASSERT(lock_held_by_current_thread(&dcache_lock));
+    key.parent = parent;
+    strlcpy(key.name, name, sizeof key.name);
+    e = hash_find(&dentry_index, &key.hash_elem);
+    return e != NULL ? hash_entry(e, struct dentry, hash_elem) : NULL;
+}
+
+/*! Returns the entry for NAME in PARENT, making one if there is none,
+    from a free entry or else the least recently used one, and marks it
+    most recently used.  Must be called with dcache_lock held. */
+static struct dentry *dentry_get(block_sector_t parent, const char *name) {
+    struct dentry *d = dentry_find(parent, name);
+
+    if (d == NULL) {
+        if (!list_empty(&dentry_free)) {
+            d = list_entry(list_pop_front(&dentry_free), struct dentry,
+                           lru_elem);
+        } else {
+            d = list_entry(list_pop_back(&dentry_lru), struct dentry,
+                           lru_elem);
+            hash_delete(&dentry_index, &d->hash_elem);
+        }
+        d->parent = parent;
+        strlcpy(d->name, name, sizeof d->name);
+        hash_insert(&dentry_index, &d->hash_elem);
+    } else {
+        list_remove(&d->lru_elem);
+    }
+    list_push_front(&dentry_lru, &d->lru_elem);
+    return d;
+}
+
+/*! Hashes an entry by its directory and name. */
+static unsigned dentry_hash(const struct hash_elem *e, void *aux UNUSED) {
+    const struct dentry *d = hash_entry(e, struct dentry, hash_elem);
+    return hash_string(d->name) ^ hash_int(d->parent);
+}
+
+/*! Orders entries by directory, then name. */
+static bool dentry_less(const struct hash_elem *a, const struct hash_elem *b,
+                        void *aux UNUSED) {
+    const struct dentry *x = hash_entry(a, struct dentry, hash_elem);
+    const struct dentry *y = hash_entry(b, struct dentry, hash_elem);
+    if (x->parent != y->parent)
+        return x->parent < y->parent;
+    return strcmp(x->name, y->name) < 0;
+}
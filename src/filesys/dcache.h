@@ -0,0 +1,27 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/block.h"
+
+/*! Number of names the directory entry cache remembers. */
+#define DCACHE_SIZE 256
+
+/*! Result of looking a name up in the directory entry cache. */
+enum dcache_result {
+    DCACHE_MISS,                /*!< Not cached; search the directory. */
+    DCACHE_HIT,                 /*!< Found, sector and kind returned. */
+    DCACHE_NEGATIVE             /*!< Known not to exist. */
+};
+
+void dcache_init(void);
+enum dcache_result dcache_lookup(block_sector_t parent, const char *name,
+                                 block_sector_t *sector, bool *is_dir);
+void dcache_insert(block_sector_t parent, const char *name,
+                   block_sector_t sector, bool is_dir);
+void dcache_insert_negative(block_sector_t parent, const char *name);
+void dcache_invalidate(block_sector_t parent, const char *name);
+void dcache_invalidate_dir(block_sector_t parent);
+void dcache_print_stats(void);
+
+#endif /* filesys/dcache.h */
@@ -1,9 +1,12 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "threads/malloc.h"
 
 /*! A directory. */
@@ -20,14 +23,68 @@ struct dir_entry {
     bool is_dir;
 };
 
-/*! Creates a directory with space for ENTRY_CNT entries in the
+/*! Hashed directories.
+
+    A directory made by dir_create() starts with a header entry.  The
+    header reads as an unused entry to anything that scans the entries in
+    order.  The directory keeps its entries in a hash table of slot_cnt
+    slots after the header.  An entry is found by hashing its name and
+    probing linearly from there.
+
+    A slot that was never used has an empty name, and ends a probe.
+    dir_remove() leaves the name in place, so that probes carry on past
+    removed entries, unless the slot after it was never used.  Then no probe
+    needs it, and it goes back to never used, along with the removed entries
+    just before it.  dir_add() reuses removed slots as well.
+
+    When an entry can't be placed within DIR_PROBE_MAX slots of its hash,
+    the table doubles in size.  A new table is appended to the file and the
+    header switched to it.  The first table has DIR_SLOTS_MIN slots and each
+    table follows the one before it, so the current table starts at slot
+    1 + slot_cnt - DIR_SLOTS_MIN.  The entries of the old table move over
+    DIR_MOVE_SLOTS slots at a time, with each dir_add(), so that no
+    operation has to rewrite the whole directory.  The header counts the
+    slots left to move.  Until none are, lookups search the old table too,
+    and entries go anywhere in the new one rather than growing it again.
+
+    Directories without the header, from before, are searched linearly. */
+#define DIR_SLOTS_MIN 16
+#define DIR_PROBE_MAX 16
+#define DIR_MOVE_SLOTS 4
+#define DIR_HASH_MAGIC "#hashed"
+
+static bool dir_hashed(const struct dir *dir, uint32_t *slot_cnt,
+                       uint32_t *pending);
+static bool dir_set_header(struct dir *dir, uint32_t slot_cnt,
+                           uint32_t pending);
+static off_t slot_ofs(uint32_t slot_cnt, uint32_t slot);
+static bool slot_insert(struct dir *dir, uint32_t slot_cnt,
+                        const struct dir_entry *e, uint32_t probe_max);
+static void slot_reclaim(struct dir *dir, uint32_t slot_cnt, uint32_t slot);
+static bool dir_grow(struct dir *dir, uint32_t *slot_cnt);
+static bool dir_move(struct dir *dir, uint32_t slot_cnt, uint32_t *pending);
+
+/*! Creates a hashed directory with space for ENTRY_CNT entries in the
     given SECTOR.  Returns true if successful, false on failure. */
 bool dir_create(block_sector_t sector, size_t entry_cnt, block_sector_t parent) {
-    if (!inode_create(sector, entry_cnt * sizeof(struct dir_entry)))
+    uint32_t slot_cnt = DIR_SLOTS_MIN;
+
+    // Keep the table at most half full
+    while (slot_cnt < entry_cnt * 2)
+        slot_cnt *= 2;
+
+    journal_begin();
+    if (!inode_create(sector, slot_ofs(slot_cnt, slot_cnt))) {
+        journal_end();
         return false;
+    }
 
     struct dir *new_dir = dir_open(inode_open(sector));
-
+    if (new_dir == NULL || !dir_set_header(new_dir, slot_cnt, 0)) {
+        dir_close(new_dir);
+        journal_end();
+        return false;
+    }
 
     // Add actual entries pointing to .. and .
     if(parent){
@@ -36,6 +93,7 @@ bool dir_create(block_sector_t sector, size_t entry_cnt, block_sector_t parent)
     
     dir_add(new_dir, PATH_WD, sector, true);
     dir_close(new_dir);
+    journal_end();
 
     return true;
 
@@ -82,18 +140,173 @@ struct inode * dir_get_inode(struct dir *dir) {
     return dir->inode;
 }
 
+/*! Returns true if DIR is hashed, storing the size of its hash table in
+    *SLOT_CNT and the slots of the old table left to move in *PENDING, or
+    false if it is a plain list of entries.  The count of slots to move
+    follows the magic in the header's name, and is 0 in headers from before
+    it. */
+static bool dir_hashed(const struct dir *dir, uint32_t *slot_cnt,
+                       uint32_t *pending) {
+    struct dir_entry e;
+
+    if (inode_read_at(dir->inode, &e, sizeof(e), 0) != sizeof(e) ||
+        e.in_use || e.name[0] != '\0' || strcmp(e.name + 1, DIR_HASH_MAGIC))
+        return false;
+    *slot_cnt = e.inode_sector;
+    memcpy(pending, e.name + 1 + sizeof DIR_HASH_MAGIC, sizeof *pending);
+    return true;
+}
+
+/*! Writes the header of hashed directory DIR, with a table of SLOT_CNT
+    slots and PENDING slots of the old one left to move.  Returns true if
+    successful. */
+static bool dir_set_header(struct dir *dir, uint32_t slot_cnt,
+                           uint32_t pending) {
+    struct dir_entry e;
+
+    ASSERT(1 + sizeof DIR_HASH_MAGIC + sizeof pending <= sizeof e.name);
+    memset(&e, 0, sizeof(e));
+    e.inode_sector = slot_cnt;
+    strlcpy(e.name + 1, DIR_HASH_MAGIC, sizeof(e.name) - 1);
+    memcpy(e.name + 1 + sizeof DIR_HASH_MAGIC, &pending, sizeof pending);
+    return inode_write_at(dir->inode, &e, sizeof(e), 0) == sizeof(e);
+}
+
+/*! Returns the byte offset of SLOT in a table of SLOT_CNT slots. */
+static off_t slot_ofs(uint32_t slot_cnt, uint32_t slot) {
+    return (1 + slot_cnt - DIR_SLOTS_MIN + slot) * sizeof(struct dir_entry);
+}
+
+/*! Writes E to the first free slot of DIR's table of SLOT_CNT slots that
+    is within PROBE_MAX slots of E's hash.  Returns true if successful,
+    false if there is no such slot or on error. */
+static bool slot_insert(struct dir *dir, uint32_t slot_cnt,
+                        const struct dir_entry *e, uint32_t probe_max) {
+    struct dir_entry old;
+    uint32_t h = hash_string(e->name), i;
+    off_t ofs;
+
+    for (i = 0; i < probe_max && i < slot_cnt; i++) {
+        ofs = slot_ofs(slot_cnt, (h + i) & (slot_cnt - 1));
+        if (inode_read_at(dir->inode, &old, sizeof(old), ofs) != sizeof(old))
+            return false;
+        if (!old.in_use)
+            return inode_write_at(dir->inode, e, sizeof(*e), ofs) ==
+                sizeof(*e);
+    }
+    return false;
+}
+
+/*! Turns SLOT of DIR's table of SLOT_CNT slots, just removed, back into a
+    slot never used if the slot after it was never used, and likewise up to
+    DIR_PROBE_MAX removed slots before it. */
+static void slot_reclaim(struct dir *dir, uint32_t slot_cnt, uint32_t slot) {
+    struct dir_entry e;
+    uint32_t mask = slot_cnt - 1, i;
+    off_t ofs;
+
+    ofs = slot_ofs(slot_cnt, (slot + 1) & mask);
+    if (inode_read_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e) ||
+        e.in_use || e.name[0] != '\0')
+        return;
+    for (i = 0; i < DIR_PROBE_MAX && i < slot_cnt; i++) {
+        ofs = slot_ofs(slot_cnt, (slot - i) & mask);
+        if (inode_read_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e) ||
+            e.in_use || e.name[0] == '\0')
+            return;
+        memset(&e, 0, sizeof(e));
+        if (inode_write_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e))
+            return;
+    }
+}
+
+/*! Doubles the hash table of DIR, which has *SLOT_CNT slots, by appending
+    an empty table to the file and pointing the header at it, with all of
+    the old table left to move.  Returns true if successful, false on
+    failure, leaving the old table in use. */
+static bool dir_grow(struct dir *dir, uint32_t *slot_cnt) {
+    struct dir_entry e;
+    uint32_t new_cnt = *slot_cnt * 2;
+
+    /* The file grows with zeros, which read as slots never used. */
+    memset(&e, 0, sizeof(e));
+    if (inode_write_at(dir->inode, &e, sizeof(e),
+                       slot_ofs(new_cnt, new_cnt - 1)) != sizeof(e) ||
+        !dir_set_header(dir, new_cnt, *slot_cnt))
+        return false;
+    *slot_cnt = new_cnt;
+    return true;
+}
+
+/*! Moves the entries in up to DIR_MOVE_SLOTS of the *PENDING slots left in
+    the old table of DIR into its table of SLOT_CNT slots, and records how
+    many are left.  Each entry is copied before it is removed from the old
+    table, so lookups always find it.  Returns true if successful. */
+static bool dir_move(struct dir *dir, uint32_t slot_cnt, uint32_t *pending) {
+    struct dir_entry e;
+    uint32_t old_cnt = slot_cnt / 2, i;
+    off_t ofs;
+
+    for (i = 0; i < DIR_MOVE_SLOTS && *pending > 0; i++, (*pending)--) {
+        ofs = slot_ofs(old_cnt, old_cnt - *pending);
+        if (inode_read_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e))
+            return false;
+        if (!e.in_use)
+            continue;
+        if (!slot_insert(dir, slot_cnt, &e, slot_cnt))
+            return false;
+        /* The old table is past the header now, but mustn't show up twice
+           to dir_readdir(). */
+        e.in_use = false;
+        if (inode_write_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e))
+            return false;
+    }
+    return dir_set_header(dir, slot_cnt, *pending);
+}
+
+/*! Searches DIR's table of SLOT_CNT slots for NAME, as lookup() does. */
+static bool table_lookup(const struct dir *dir, uint32_t slot_cnt,
+                         const char *name, struct dir_entry *ep,
+                         off_t *ofsp) {
+    struct dir_entry e;
+    uint32_t h = hash_string(name), i;
+    off_t ofs;
+
+    for (i = 0; i < slot_cnt; i++) {
+        ofs = slot_ofs(slot_cnt, (h + i) & (slot_cnt - 1));
+        if (inode_read_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e) ||
+            (!e.in_use && e.name[0] == '\0'))
+            break;
+        if (e.in_use && !strcmp(name, e.name)) {
+            if (ep != NULL)
+                *ep = e;
+            if (ofsp != NULL)
+                *ofsp = ofs;
+            return true;
+        }
+    }
+    return false;
+}
+
 /*! Searches DIR for a file with the given NAME.
     If successful, returns true, sets *EP to the directory entry
     if EP is non-null, and sets *OFSP to the byte offset of the
     directory entry if OFSP is non-null.
-    otherwise, returns false and ignores EP and OFSP. */
+    otherwise, returns false and ignores EP and OFSP.
+    Must be called with DIR's inode locked. */
 static bool lookup(const struct dir *dir, const char *name,
                    struct dir_entry *ep, off_t *ofsp) {
     struct dir_entry e;
+    uint32_t slot_cnt, pending;
     size_t ofs;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
+    ASSERT(inode_lock_held(dir->inode));
+
+    if (dir_hashed(dir, &slot_cnt, &pending))
+        return table_lookup(dir, slot_cnt, name, ep, ofsp) ||
+            (pending > 0 && table_lookup(dir, slot_cnt / 2, name, ep, ofsp));
 
     for (ofs = 0; inode_read_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e);
          ofs += sizeof(e)) {
@@ -114,16 +327,41 @@ static bool lookup(const struct dir *dir, const char *name,
 bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode,
     bool *is_dir) {
     struct dir_entry e;
+    block_sector_t parent, sector = 0;
+    bool found = false;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
-    if (lookup(dir, name, &e, NULL)) {
-        *inode = inode_open(e.inode_sector);
-        *is_dir = e.is_dir;
+    *inode = NULL;
+    if (strlen(name) > NAME_MAX)
+        return false;
+
+    /* Try the dentry cache first, and fill it in on a miss.  With the
+       directory locked, so that nothing cached for it can be out of date. */
+    parent = inode_get_inumber(dir->inode);
+    inode_lock(dir->inode);
+    switch (dcache_lookup(parent, name, &sector, is_dir)) {
+    case DCACHE_HIT:
+        found = true;
+        break;
+    case DCACHE_NEGATIVE:
+        break;
+    case DCACHE_MISS:
+        found = lookup(dir, name, &e, NULL);
+        if (found) {
+            sector = e.inode_sector;
+            *is_dir = e.is_dir;
+            dcache_insert(parent, name, sector, e.is_dir);
+        } else {
+            dcache_insert_negative(parent, name);
+        }
+        break;
     }
-    else
-        *inode = NULL;
+    inode_unlock(dir->inode);
+
+    if (found)
+        *inode = inode_open(sector);
 
     return *inode != NULL;
 }
@@ -136,6 +374,7 @@ bool dir_lookup(const struct dir *dir, const char *name, struct inode **inode,
 bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector,
     bool is_dir) {
     struct dir_entry e;
+    uint32_t slot_cnt, pending;
     off_t ofs;
     bool success = false;
 
@@ -147,8 +386,31 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector,
         return false;
 
     /* Check that NAME is not in use. */
+    journal_begin();
+    inode_lock(dir->inode);
     if (lookup(dir, name, NULL, NULL))
         goto done;
+    dcache_invalidate(inode_get_inumber(dir->inode), name);
+
+    /* In a hashed directory, put it near its hash, making room if need
+       be.  While a grown table is still filling, move some more of the old
+       one, and put it wherever it fits. */
+    if (dir_hashed(dir, &slot_cnt, &pending)) {
+        memset(&e, 0, sizeof(e));
+        e.in_use = true;
+        strlcpy(e.name, name, sizeof e.name);
+        e.inode_sector = inode_sector;
+        e.is_dir = is_dir;
+        if (pending == 0) {
+            success = slot_insert(dir, slot_cnt, &e, DIR_PROBE_MAX);
+            if (success || !dir_grow(dir, &slot_cnt))
+                goto done;
+            pending = slot_cnt / 2;
+        }
+        success = dir_move(dir, slot_cnt, &pending) &&
+            slot_insert(dir, slot_cnt, &e, slot_cnt);
+        goto done;
+    }
 
 
     /* Set OFS to offset of free slot.
@@ -172,6 +434,8 @@ bool dir_add(struct dir *dir, const char *name, block_sector_t inode_sector,
     success = inode_write_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e);
 
 done:
+    inode_unlock(dir->inode);
+    journal_end();
     return success;
 }
 
@@ -182,13 +446,21 @@ bool dir_remove(struct dir *dir, const char *name) {
     struct inode *inode = NULL;
     bool success = false;
     off_t ofs;
-    struct dir * to_delete;
+    struct dir *to_delete = NULL;
     char deletion_content[NAME_MAX + 1];
+    uint32_t slot_cnt, pending, cnt;
 
     ASSERT(dir != NULL);
     ASSERT(name != NULL);
 
+    /* A directory's own entries go with it.  Locking the parent from ".."
+       would also take directory locks out of their parent-first order. */
+    if (!strcmp(name, PATH_WD) || !strcmp(name, PATH_PARENT))
+        return false;
+
     /* Find directory entry. */
+    journal_begin();
+    inode_lock(dir->inode);
     if (!lookup(dir, name, &e, &ofs))
         goto done;
     /* Open inode. */
@@ -200,29 +472,48 @@ bool dir_remove(struct dir *dir, const char *name) {
     if(e.is_dir){
         if(inode_is_shared(inode))
             goto done;
-        to_delete = dir_open(inode);
+        to_delete = dir_open(inode_reopen(inode));
         if(!to_delete)
             goto done;
+        // Keep entries from being added until it is gone
+        inode_lock(inode);
         while(dir_readdir(to_delete, deletion_content)){
             if(strcmp(deletion_content, PATH_WD) &&
                 strcmp(deletion_content, PATH_PARENT)){
+                inode_unlock(inode);
+                dir_close(to_delete);
                 goto done;
             }
                 
         }
     }
 
-    /* Erase directory entry. */
+    /* Erase directory entry, reclaiming its slot if no probe needs it. */
     e.in_use = false;
-    if (inode_write_at(dir->inode, &e, sizeof(e), ofs) != sizeof(e))
-        goto done;
+    if (inode_write_at(dir->inode, &e, sizeof(e), ofs) == sizeof(e)) {
+        if (dir_hashed(dir, &slot_cnt, &pending)) {
+            cnt = ofs >= slot_ofs(slot_cnt, 0) ? slot_cnt : slot_cnt / 2;
+            slot_reclaim(dir, cnt, ofs / sizeof(e) - slot_ofs(cnt, 0) /
+                         sizeof(e));
+        }
 
-    /* Remove inode. */
-    inode_remove(inode);
-    success = true;
+        /* Remove inode, and what is cached under it if it is a directory,
+           before its sector can be reused. */
+        dcache_invalidate(inode_get_inumber(dir->inode), name);
+        if (e.is_dir)
+            dcache_invalidate_dir(e.inode_sector);
+        inode_remove(inode);
+        success = true;
+    }
+    if (to_delete != NULL) {
+        inode_unlock(inode);
+        dir_close(to_delete);
+    }
 
 done:
+    inode_unlock(dir->inode);
     inode_close(inode);
+    journal_end();
     return success;
 }
 
@@ -90,6 +90,31 @@ off_t file_write_at(struct file *file, const void *buffer, off_t size,
     return inode_write_at(file->inode, buffer, size, file_ofs);
 }
 
+/*! Reads up to CNT whole sectors from FILE, whose current position must be
+    a multiple of BLOCK_SECTOR_SIZE, into BUFFERS, one sector apiece, going
+    around the buffer cache where it can.  Returns the number of bytes
+    actually read, which stops short of a partial sector at end of file.
+    Advances FILE's position by the number of bytes read. */
+off_t file_read_sectors(struct file *file, void *const buffers[], size_t cnt) {
+    off_t bytes_read = inode_read_sectors(file->inode, buffers, cnt,
+                                          file->pos);
+    file->pos += bytes_read;
+    return bytes_read;
+}
+
+/*! Writes CNT whole sectors from BUFFERS, one sector apiece, into FILE,
+    whose current position must be a multiple of BLOCK_SECTOR_SIZE, going
+    around the buffer cache where it can.  Returns the number of bytes
+    actually written.  Advances FILE's position by the number of bytes
+    written. */
+off_t file_write_sectors(struct file *file, const void *const buffers[],
+                         size_t cnt) {
+    off_t bytes_written = inode_write_sectors(file->inode, buffers, cnt,
+                                              file->pos);
+    file->pos += bytes_written;
+    return bytes_written;
+}
+
 /*! Prevents write operations on FILE's underlying inode
     until file_allow_write() is called or FILE is closed. */
 void file_deny_write(struct file *file) {
@@ -3,6 +3,7 @@
 
 #include "filesys/off_t.h"
 #include <stdbool.h>
+#include <stddef.h>
 
 struct inode;
 
@@ -17,6 +18,9 @@ off_t file_read (struct file *, void *, off_t);
 off_t file_read_at (struct file *, void *, off_t size, off_t start);
 off_t file_write (struct file *, const void *, off_t);
 off_t file_write_at (struct file *, const void *, off_t size, off_t start);
+off_t file_read_sectors (struct file *, void *const buffers[], size_t cnt);
+off_t file_write_sectors (struct file *, const void *const buffers[],
+                          size_t cnt);
 
 /* Preventing writes. */
 void file_deny_write (struct file *);
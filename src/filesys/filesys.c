@@ -5,12 +5,17 @@
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "userprog/process.h"
 
 /*! Partition that contains the file system. */
 struct block *fs_device;
 
+/*! Format with extent inodes instead of direct/indirect trees. */
+bool filesys_format_extents;
+
 block_sector_t filesys_size(void);
 static void do_format(void);
 
@@ -22,11 +27,17 @@ void filesys_init(bool format) {
         PANIC("No file system device found, can't initialize file system.");
 	
     inode_init();
+    dcache_init();
     free_map_init();
+    journal_init();
 
     if (format) 
         do_format();
+    else
+        journal_open();
 
+    /* New files use whatever layout the file system was formatted with. */
+    inode_set_layout(inode_layout_at(ROOT_DIR_SECTOR));
     free_map_open();
 }
 
@@ -36,10 +47,10 @@ block_sector_t filesys_size(void) {
 
 /*! Shuts down the file system module, writing any unwritten data to disk. */
 void filesys_done(void) {
-	/* Write blocks in cache back to memory. */
-	refresh_cache();
-	
+    /* Put the free map in the cache, then write blocks in cache back to
+       memory. */
     free_map_close();
+	refresh_cache();
 }
 
 /* checks that path given, stores that the last directory the and entry name
@@ -104,6 +115,7 @@ bool filesys_create(const char *path, off_t initial_size, bool is_dir) {
     struct dir *dir = NULL;
     if(!resolve_path(path, &dir, name))
         return false;
+    journal_begin();
     bool success = (free_map_allocate(&inode_sector) &&
                     (is_dir ? dir_create(inode_sector, initial_size,
                         filesys_get_inumber(dir)): 
@@ -111,6 +123,7 @@ bool filesys_create(const char *path, off_t initial_size, bool is_dir) {
                     dir_add(dir, name, inode_sector, is_dir));
     if (!success && inode_sector != 0) 
         free_map_release(inode_sector);
+    journal_end();
     dir_close(dir);
 
     return success;
@@ -153,10 +166,13 @@ bool filesys_remove(const char *path) {
 /*! Formats the file system. */
 static void do_format(void) {
     printf("Formatting file system...");
+    inode_set_layout(filesys_format_extents ? INODE_LAYOUT_EXTENT
+                                            : INODE_LAYOUT_TREE);
     free_map_create();
     if (!dir_create(ROOT_DIR_SECTOR, 4, ROOT_DIR_SECTOR))
         PANIC("root directory creation failed");
     free_map_close();
+    journal_create();
     printf("done.\n");
 }
 
@@ -9,11 +9,15 @@
 #define DEBUG_SECTOR 0       /*!< Reserved for debugging. */
 #define FREE_MAP_SECTOR 1       /*!< Free map file inode sectors. */
 #define ROOT_DIR_SECTOR 2       /*!< Root directory file inode sector. */
+#define JOURNAL_SECTOR 3        /*!< First sector of the journal. */
 /*! @} */
 
 /*! Block device that contains the file system. */
 struct block *fs_device;
 
+/*! Give files extents instead of a block tree when formatting (-extents). */
+extern bool filesys_format_extents;
+
 void filesys_init(bool format);
 void filesys_done(void);
 bool filesys_create(const char *name, off_t initial_size, bool is_dir);
@@ -1,44 +1,238 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/journal.h"
+#include "threads/synch.h"
 #include <stdio.h>
 
+/*! The free map is kept in memory and written back lazily.  Allocating
+    or releasing sectors changes only the in-memory bitmap and marks which
+    sectors of the free map file it has made stale.  free_map_flush(), run
+    by the buffer cache at the start of every flush, copies just those
+    sectors into the cache, so they reach the disk in the same sweep as the
+    inode and indirect blocks changed along with them.
+
+    With a journal, the map sectors are metadata and are committed together
+    with the rest of the flush.  Sectors released since the last flush are
+    only noted as pending.  The flush frees them as it starts committing,
+    and they can be allocated again once it has finished.  Until then a
+    crash may roll the file that held them back to the last commit.
+
+    Without a journal, the map on disk is exact only after a clean
+    shutdown.  After a crash:
+
+    - Sectors may be marked used that no file references.  This happens
+      to sectors in preallocation windows, and to sectors whose file was
+      still being created or removed.  They leak until the next format.
+
+    - Sectors referenced by a file may be marked free.  This happens when
+      the crash interrupts a flush after the file's metadata was written
+      but before the map sector was.  Only metadata that was changed
+      during the last flush interval is exposed.
+
+    - Any sector is set in memory before metadata referring to it is
+      written to the cache.  A bit is cleared only after the file that
+      used the sector has been removed.  So a consistent map is always
+      just one complete flush away. */
+
 static struct file *free_map_file;   /*!< Free map file. */
 static struct bitmap *free_map;      /*!< Free map, one bit per sector. */
+static struct bitmap *free_map_dirty;   /*!< Stale sectors of the file. */
+static struct bitmap *free_map_pending; /*!< Released, not yet committed. */
+static struct lock free_map_lock;    /*!< Protects the above. */
+
+/*! Bits of the free map held by one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+static void free_map_touch(size_t start, size_t cnt);
 
 /*! Initializes the free map. */
 void free_map_init(void) {
-    free_map = bitmap_create(block_size(fs_device) * 4);
+    size_t sectors = block_size(fs_device);
+
+    lock_init(&free_map_lock);
+    free_map = bitmap_create(sectors * 4);
     if (free_map == NULL)
         PANIC("bitmap creation failed--file system device is too large");
     bitmap_mark(free_map, DEBUG_SECTOR);
     bitmap_mark(free_map, FREE_MAP_SECTOR);
     bitmap_mark(free_map, ROOT_DIR_SECTOR);
+    bitmap_set_multiple(free_map, JOURNAL_SECTOR, JOURNAL_SECTORS, true);
+
+    /* The map has room for more sectors than the device has.  Keep the
+       allocator off the ones that don't exist. */
+    bitmap_set_multiple(free_map, sectors, bitmap_size(free_map) - sectors,
+                        true);
+
+    free_map_dirty = bitmap_create(DIV_ROUND_UP(bitmap_size(free_map),
+                                                BITS_PER_SECTOR));
+    free_map_pending = bitmap_create(bitmap_size(free_map));
+    if (free_map_dirty == NULL || free_map_pending == NULL)
+        PANIC("bitmap creation failed--file system device is too large");
+}
+
+/*! Notes that the file sectors holding bits START through START + CNT - 1
+    of the free map are stale.  Must be called with free_map_lock held. */
+static void free_map_touch(size_t start, size_t cnt) {
+    size_t first = start / BITS_PER_SECTOR;
+    size_t last = (start + cnt - 1) / BITS_PER_SECTOR;
+    bitmap_set_multiple(free_map_dirty, first, last - first + 1, true);
+}
+
+/*! Frees the sectors pending release and copies the stale sectors of the
+    free map into its file.  Called by the buffer cache before each flush,
+    so that they are written with it. */
+void free_map_flush(void) {
+    size_t i;
+
+    lock_acquire(&free_map_lock);
+    for (i = bitmap_scan(free_map_pending, 0, 1, true); i != BITMAP_ERROR;
+         i = bitmap_scan(free_map_pending, i + 1, 1, true)) {
+        bitmap_reset(free_map, i);
+        free_map_touch(i, 1);
+    }
+    bitmap_set_all(free_map_pending, false);
+    if (free_map_file != NULL) {
+        for (i = bitmap_scan(free_map_dirty, 0, 1, true); i != BITMAP_ERROR;
+             i = bitmap_scan(free_map_dirty, i + 1, 1, true)) {
+            if (!bitmap_write_part(free_map, free_map_file,
+                                   i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+                break;
+            bitmap_reset(free_map_dirty, i);
+        }
+    }
+    lock_release(&free_map_lock);
+}
+
+/*! Returns the number of sectors in the free map file, the most that
+    free_map_flush() can put in the cache.  Only depends on the size of the
+    file system device, so it can be called before free_map_init(). */
+size_t free_map_sector_cnt(void) {
+    return DIV_ROUND_UP(block_size(fs_device) * 4, BITS_PER_SECTOR);
 }
 
 /*! Allocates a sector and stores it into sectorp..
     Returns true if successful, false if no sectors were
-    available or if the free_map file could not be written. */
+    available. */
 bool free_map_allocate(block_sector_t *sectorp) {
-    block_sector_t sector = bitmap_scan_and_flip(free_map, 0, 1, false);
-    if (sector != BITMAP_ERROR && free_map_file != NULL &&
-        !bitmap_write(free_map, free_map_file)) {
-        bitmap_set_multiple(free_map, sector, 1, false); 
-        sector = BITMAP_ERROR;
+    size_t cnt;
+    return free_map_allocate_run(0, 1, sectorp, &cnt);
+}
+
+/*! Allocates between 1 and CNT contiguous sectors, storing the first in
+    *STARTP and how many there are in *CNTP.  Tries first to start the run
+    at GOAL, so that a file can grow in place, then looks for the first run
+    of CNT free sectors at or after GOAL, wrapping around to the start of
+    the disk, then for ever shorter runs the same way.  Returns true if
+    successful, false if no sectors were available. */
+bool free_map_allocate_run(block_sector_t goal, size_t cnt,
+                           block_sector_t *startp, size_t *cntp) {
+    size_t start = BITMAP_ERROR, n = 0;
+
+    ASSERT(cnt > 0);
+    lock_acquire(&free_map_lock);
+
+    if (goal >= bitmap_size(free_map))
+        goal = 0;
+
+    /* As much as is free starting right at GOAL. */
+    if (goal != 0) {
+        while (n < cnt && goal + n < bitmap_size(free_map) &&
+               !bitmap_test(free_map, goal + n))
+            n++;
+        if (n > 0)
+            start = goal;
+    }
+
+    /* Otherwise the nearest run past GOAL that fits, settling for less
+       each time. */
+    if (start == BITMAP_ERROR) {
+        for (n = cnt; n > 0; n /= 2) {
+            start = bitmap_scan(free_map, goal, n, false);
+            if (start == BITMAP_ERROR && goal != 0)
+                start = bitmap_scan(free_map, 0, n, false);
+            if (start != BITMAP_ERROR)
+                break;
+        }
     }
-    if (sector != BITMAP_ERROR)
-        *sectorp = sector;
-    return sector != BITMAP_ERROR;
+    if (start == BITMAP_ERROR) {
+        lock_release(&free_map_lock);
+        return false;
+    }
+
+    bitmap_set_multiple(free_map, start, n, true);
+    free_map_touch(start, n);
+    lock_release(&free_map_lock);
+
+    *startp = start;
+    *cntp = n;
+    return true;
 }
 
 /*! Makes sector at SECTOR available for use. */
 void free_map_release(block_sector_t sector) {
-    ASSERT(bitmap_all(free_map, sector, 1));
-    bitmap_set_multiple(free_map, sector, 1, false);
-    bitmap_write(free_map, free_map_file);
+    free_map_release_run(sector, 1);
+}
+
+/*! Makes the CNT sectors starting at START available for use, once the
+    journal has committed their release if there is a journal. */
+void free_map_release_run(block_sector_t start, size_t cnt) {
+    lock_acquire(&free_map_lock);
+    ASSERT(bitmap_all(free_map, start, cnt));
+    if (journal_enabled()) {
+        bitmap_set_multiple(free_map_pending, start, cnt, true);
+    } else {
+        bitmap_set_multiple(free_map, start, cnt, false);
+        free_map_touch(start, cnt);
+    }
+    lock_release(&free_map_lock);
+}
+
+/*! Initializes WINDOW as empty, with the file's next sector wanted at
+    GOAL. */
+void free_map_window_init(struct free_map_window *window, block_sector_t goal) {
+    window->start = goal;
+    window->cnt = 0;
+}
+
+/*! Allocates between 1 and CNT contiguous sectors for the file that owns
+    WINDOW, storing the first in *STARTP and how many there are in *CNTP.
+    They come from the front of the window.  If the window is empty, it is
+    refilled first with a run of up to CNT + FREE_MAP_PREALLOC sectors as
+    near its start as possible, so that files growing a little at a time
+    still end up contiguous even when other files grow in between.  Returns
+    true if successful, false if no sectors were available.
+
+    The window's sectors are marked used in the free map on disk, so a crash
+    while a file holds a window leaks them until the disk is formatted
+    again.  Call free_map_window_release() once the file stops growing. */
+bool free_map_allocate_window(struct free_map_window *window, size_t cnt,
+                              block_sector_t *startp, size_t *cntp) {
+    size_t n;
+
+    ASSERT(cnt > 0);
+    if (window->cnt == 0 &&
+        !free_map_allocate_run(window->start, cnt + FREE_MAP_PREALLOC,
+                               &window->start, &window->cnt))
+        return false;
+
+    n = cnt < window->cnt ? cnt : window->cnt;
+    *startp = window->start;
+    *cntp = n;
+    window->start += n;
+    window->cnt -= n;
+    return true;
+}
+
+/*! Gives the sectors left in WINDOW back to the free map. */
+void free_map_window_release(struct free_map_window *window) {
+    if (window->cnt > 0)
+        free_map_release_run(window->start, window->cnt);
+    window->cnt = 0;
 }
 
 /*! Opens the free map file and reads it from disk. */
@@ -52,7 +246,13 @@ void free_map_open(void) {
 
 /*! Writes the free map to disk and closes the free map file. */
 void free_map_close(void) {
+    journal_begin();
+    free_map_flush();
+    journal_end();
+    lock_acquire(&free_map_lock);
     file_close(free_map_file);
+    free_map_file = NULL;
+    lock_release(&free_map_lock);
 }
 
 /*! Creates a new free map file on disk and writes the free map to it. */
@@ -68,5 +268,6 @@ void free_map_create(void) {
         PANIC("can't open free map");
     if (!bitmap_write(free_map, free_map_file))
         PANIC("can't write free map");
+    bitmap_set_all(free_map_dirty, false);
 }
 
@@ -10,9 +10,30 @@ void free_map_read(void);
 void free_map_create(void);
 void free_map_open(void);
 void free_map_close(void);
+void free_map_flush(void);
+size_t free_map_sector_cnt(void);
 
 bool free_map_allocate(block_sector_t *);
+bool free_map_allocate_run(block_sector_t goal, size_t cnt,
+                           block_sector_t *startp, size_t *cntp);
 void free_map_release(block_sector_t);
+void free_map_release_run(block_sector_t start, size_t cnt);
+
+/*! Sectors to reserve past what a growing file asks for. */
+#define FREE_MAP_PREALLOC 16
+
+/*! Preallocation window of a growing file: CNT sectors starting at START,
+    marked used in the free map but not yet part of the file.  While the
+    window is empty, START is where the file's next sector should go. */
+struct free_map_window {
+    block_sector_t start;
+    size_t cnt;
+};
+
+void free_map_window_init(struct free_map_window *, block_sector_t goal);
+bool free_map_allocate_window(struct free_map_window *, size_t cnt,
+                              block_sector_t *startp, size_t *cntp);
+void free_map_window_release(struct free_map_window *);
 
 #endif /* filesys/free-map.h */
 
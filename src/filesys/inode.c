@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -6,227 +7,639 @@
 #include <stdio.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "filesys/journal.h"
 #include "filesys/cache.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
 
-/*! Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+/*! Identifies an inode, and which layout it uses for its data. */
+#define INODE_MAGIC 0x494e4f44          /*!< Direct/indirect tree. */
+#define EXTENT_MAGIC 0x45585444         /*!< List of extents. */
 #define NUM_DIRECT 60
 #define NUM_SINGLE_INDIRECT 40
 #define NUM_DOUBLE_INDIRECT 1
+#define NUM_EXTENTS 61                  /*!< Extents held in the inode. */
 
 #define ENTRIES_PER_SECTOR (BLOCK_SECTOR_SIZE / (sizeof(block_sector_t)))
+#define EXTENTS_PER_SECTOR (BLOCK_SECTOR_SIZE / (sizeof(struct extent)))
+#define LEAVES_PER_INDEX (BLOCK_SECTOR_SIZE / (sizeof(struct extent_ref)))
+
+/* Bounds, in sectors, on how far ahead of a sequential reader to prefetch. */
+#define READ_AHEAD_MIN 4
+#define READ_AHEAD_MAX 64
+
+/* Entries of an indirect block kept in the inode, few enough for the inode
+ * to fit in a kilobyte. */
+#define IND_CACHE_ENTRIES 64
+
+/*! Sectors filled in or added to a file per journaled operation, few enough
+    that the indirect and extent blocks they touch stay within
+    JOURNAL_OP_BLOCKS. */
+#define GROW_OP_SECTORS 64
 
 #define CEIL(a, b) (((a) / (b)) + (((a) % (b)) > 0 ? 1 : 0))
 
+/*! A run of LENGTH consecutive sectors of a file, stored consecutively on
+    disk starting at START. */
+struct extent {
+    block_sector_t start;
+    block_sector_t length;
+};
+
+/*! Entry in an extent index block.  Extents past the first NUM_EXTENTS are
+    kept in leaf blocks of EXTENTS_PER_SECTOR each, filled in order; the
+    index records where each leaf is and the first file sector it maps. */
+struct extent_ref {
+    block_sector_t first;
+    block_sector_t leaf;
+};
+
 /*! On-disk inode.
     Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-    block_sector_t direct[NUM_DIRECT];
-    block_sector_t single_indirect[NUM_SINGLE_INDIRECT];
-    block_sector_t double_indirect;
+    union {
+        /*! Layout of inodes with INODE_MAGIC. */
+        struct {
+            block_sector_t direct[NUM_DIRECT];
+            block_sector_t single_indirect[NUM_SINGLE_INDIRECT];
+            block_sector_t double_indirect;
+        };
+        /*! Layout of inodes with EXTENT_MAGIC. */
+        struct {
+            uint32_t extent_cnt;        /*!< Number of extents. */
+            block_sector_t sector_cnt;  /*!< Sectors they add up to. */
+            block_sector_t extent_index;    /*!< Index of leaf blocks, or 0. */
+            struct extent extents[NUM_EXTENTS];
+        };
+        /** Unused bytes **/
+        unsigned unused[ENTRIES_PER_SECTOR - 2];
+    };
     off_t length;                       /*!< File size in bytes. */
     unsigned magic;                     /*!< Magic number. */
-
-    /** Unused bytes **/
-    unsigned unused[ENTRIES_PER_SECTOR-NUM_DIRECT-NUM_SINGLE_INDIRECT-NUM_DOUBLE_INDIRECT-2];
 };
 
 /*! In-memory inode. */
 struct inode {
-    struct list_elem elem;              /*!< Element in inode list. */
+    struct hash_elem elem;              /*!< Element in open_inodes. */
     block_sector_t sector;              /*!< Sector number of disk location. */
     int open_cnt;                       /*!< Number of openers. */
     bool removed;                       /*!< True if deleted, false otherwise. */
+    bool loading;                       /*!< Set while data is being read. */
     int deny_write_cnt;                 /*!< 0: writes ok, >0: deny writes. */
     struct lock extension_lock;         /*!< A lock for atomic file extension. */
+    struct lock lock;                   /*!< Held by inode_lock(). */
+    off_t ra_next;                      /*!< Where a sequential read would
+                                             start next. */
+    off_t ra_end;                       /*!< End of the prefetched range. */
+    int ra_window;                      /*!< Sectors to prefetch ahead. */
+    struct free_map_window prealloc;    /*!< Sectors reserved for growth,
+                                             under extension_lock. */
+    struct inode_disk data;             /*!< Copy of the inode's sector,
+                                             changed under extension_lock. */
+    struct lock map_lock;               /*!< Protects the indirect copy. */
+    block_sector_t ind_first;           /*!< First block ind maps. */
+    block_sector_t ind_cnt;             /*!< Entries of ind usable. */
+    block_sector_t ind[IND_CACHE_ENTRIES]; /*!< Copy of the part of the
+                                             indirect block looked at last. */
 };
 
 
 bool is_valid_inode(const struct inode_disk *inode);
-bool allocate_direct(block_sector_t *sector, off_t *length);
-bool allocate_indirect(block_sector_t *sector, off_t *length);
-bool allocate_double_indirect(block_sector_t *sector, off_t *length);
 void free_direct(block_sector_t sector, off_t *length);
 void free_indirect(block_sector_t sector, off_t *length);
 void free_double_indirect(block_sector_t sector, off_t *length);
-bool grow_direct(block_sector_t *sector);
-bool grow_indirect(block_sector_t *sector, block_sector_t index);
-bool grow_double_indirect(block_sector_t *sector, block_sector_t index1, block_sector_t index2);
-void inode_set_length(const struct inode *inode, off_t length);
+bool grow_direct(struct free_map_window *window, block_sector_t *sector, bool data);
+bool grow_indirect(struct free_map_window *window, block_sector_t *sector, block_sector_t index);
+bool grow_double_indirect(struct free_map_window *window, block_sector_t *sector,
+                          block_sector_t index1, block_sector_t index2);
+void inode_set_length(struct inode *inode, off_t length);
 bool inode_extend(struct inode *inode, block_sector_t num);
+static bool window_allocate(struct free_map_window *window,
+                            block_sector_t *sector);
+static void window_aim(struct inode *inode, block_sector_t block);
+static bool inode_fill(struct inode *inode, off_t pos, off_t end);
+static bool tree_fill(struct inode *inode, block_sector_t block);
+static void inode_store(const struct inode *inode);
+static block_sector_t inode_map(struct inode *inode, off_t pos,
+                                block_sector_t *run);
+static block_sector_t tree_map(struct inode *inode, block_sector_t blocks);
+static block_sector_t extent_map(const struct inode_disk *data,
+                                 block_sector_t block, block_sector_t *run);
+static struct extent *extent_at(const struct inode_disk *data, uint32_t idx,
+                                bool write, struct cache_block **leaf);
+static void extent_done(struct cache_block *leaf, bool write);
+static bool extent_append(struct inode_disk *data, block_sector_t start,
+                          block_sector_t cnt);
+static bool extent_extend(struct inode_disk *data,
+                          struct free_map_window *window, block_sector_t num);
+static void extent_clear(block_sector_t start, block_sector_t cnt);
+static void extent_free(const struct inode_disk *data);
+static void inode_read_ahead(struct inode *inode, bool sequential, off_t end,
+                             int hits, int misses);
+static bool inode_write_prepare(struct inode *inode, off_t newlen,
+                                bool *locked);
+static void inode_write_done(struct inode *inode, off_t newlen, bool locked);
+
+/*! Layout given to inodes created from now on. */
+static enum inode_layout new_layout = INODE_LAYOUT_TREE;
 
 /** Returns if the inode is well formed. */
 bool is_valid_inode(const struct inode_disk *inode) {
-    return inode != NULL && inode->magic == INODE_MAGIC;
+    return inode != NULL &&
+        (inode->magic == INODE_MAGIC || inode->magic == EXTENT_MAGIC);
 }
 
 /**
- * Returns the block index of the block containing data at position. 
- * Traverses the inode tree structure until the index is found.
- * The position must be less than the file size.
+ * Returns the block index of the block containing data at position, or 0 if
+ * the position lies in a hole.  The position must be less than the file size.
  */
-static block_sector_t byte_to_sector(const struct inode *inode, off_t pos) {
+static block_sector_t byte_to_sector(struct inode *inode, off_t pos) {
+    block_sector_t run;
+    return inode_map(inode, pos, &run);
+}
+
+/**
+ * Returns the block index of the block containing data at position, and
+ * stores in run how many blocks, starting with that one, follow each other
+ * both in the file and on disk.  The tree layout doesn't keep track of that,
+ * so for it run is always 1.  Blocks that have never been written are holes,
+ * for which 0 is returned.  The position must be less than the file size.
+ */
+static block_sector_t inode_map(struct inode *inode, off_t pos,
+                                block_sector_t *run) {
     ASSERT(inode != NULL);
-    block_sector_t blocks = pos / BLOCK_SECTOR_SIZE;
-    block_sector_t single;
-    block_sector_t ret;
-    struct inode_disk *data;
-    block_sector_t *single_data;
-    block_sector_t * double_data;
+    const struct inode_disk *data = &inode->data;
 
-    // Get the main node data from cache
-    struct cache_block* cache_block = cache_read_block(inode->sector);
-    data = (struct inode_disk*) cache_block->data;
     if (!is_valid_inode(data)) {
         hex_dump(0, data, 512, false);
         PANIC("nooo");
     }
 
+    if (data->magic == EXTENT_MAGIC)
+        return extent_map(data, pos / BLOCK_SECTOR_SIZE, run);
+    *run = 1;
+    return tree_map(inode, pos / BLOCK_SECTOR_SIZE);
+}
+
+/**
+ * Traverses the inode tree structure of inode until the block with the
+ * given index is found, and returns it.  The entries around it in the
+ * indirect block it is found through are copied into the inode, so that the
+ * blocks after it can be found without going through the cache.  Entries of
+ * blocks inside the file only change when a hole is filled, which throws the
+ * copy away, so only those are used from it.  Returns 0 for a hole.
+ */
+static block_sector_t tree_map(struct inode *inode, block_sector_t blocks) {
+    const struct inode_disk *data = &inode->data;
+    block_sector_t single, ofs, first, leaf, mapped;
+    block_sector_t ret;
+    struct cache_block *cache_block;
+
     // Check it its in the direct nodes
-    if (blocks < NUM_DIRECT) {
-        ret = data->direct[blocks];
-        cache_read_end(cache_block);
+    if (blocks < NUM_DIRECT)
+        return data->direct[blocks];
+
+    lock_acquire(&inode->map_lock);
+    if (blocks - inode->ind_first < inode->ind_cnt) {
+        ret = inode->ind[blocks - inode->ind_first];
+        lock_release(&inode->map_lock);
         return ret;
-    } 
-    // Otherwise, skip over them
-    blocks -= NUM_DIRECT;
+    }
 
-    single = blocks / ENTRIES_PER_SECTOR; 
-    blocks = blocks % ENTRIES_PER_SECTOR;
+    // Entries past the length read here may still be filled in
+    mapped = CEIL(data->length, BLOCK_SECTOR_SIZE);
+    barrier();
+
+    // Otherwise, skip over the direct nodes
+    single = (blocks - NUM_DIRECT) / ENTRIES_PER_SECTOR;
+    ofs = ROUND_DOWN((blocks - NUM_DIRECT) % ENTRIES_PER_SECTOR,
+                     IND_CACHE_ENTRIES);
+    first = NUM_DIRECT + single * ENTRIES_PER_SECTOR + ofs;
     // Check if it fits in the single indirect nodes.
     if (single < NUM_SINGLE_INDIRECT) {
-        struct cache_block* indirect_block = cache_read_block(data->single_indirect[single]);
-        single_data = (block_sector_t*) indirect_block->data;
-        ret = single_data[blocks];
-        cache_read_end(indirect_block);
-        cache_read_end(cache_block);
-        return ret;
+        leaf = data->single_indirect[single];
+    } else {
+        // Skip over single indirects
+        single -= NUM_SINGLE_INDIRECT;
+
+        // Only one double indirect, so the rest must fit
+        ASSERT(single < ENTRIES_PER_SECTOR);
+
+        leaf = 0;
+        if (data->double_indirect != 0) {
+            cache_block = cache_read_block(data->double_indirect);
+            leaf = ((block_sector_t *) cache_block->data)[single];
+            cache_read_end(cache_block);
+        }
+    }
+
+    // A missing indirect block is a hole as big as the block would map
+    if (leaf == 0) {
+        lock_release(&inode->map_lock);
+        return 0;
     }
-    // Skip over single indirects
-    single-= NUM_SINGLE_INDIRECT;
-
-    // Only one double indirect, so the rest must fit
-    ASSERT(single < ENTRIES_PER_SECTOR);
-
-    struct cache_block* indirect_block = cache_read_block(data->double_indirect);
-    double_data = (block_sector_t *) indirect_block->data;
-    struct cache_block* indirect_block2 = cache_read_block(double_data[single]);
-    single_data = (block_sector_t *) indirect_block2->data;
-    ret = single_data[blocks];
-    cache_read_end(indirect_block2);
-    cache_read_end(indirect_block);
+
+    cache_block = cache_read_block(leaf);
+    memcpy(inode->ind, (block_sector_t *) cache_block->data + ofs,
+           sizeof inode->ind);
     cache_read_end(cache_block);
+    inode->ind_first = first;
+    inode->ind_cnt = mapped <= first ? 0 :
+        mapped - first < IND_CACHE_ENTRIES ? mapped - first :
+        IND_CACHE_ENTRIES;
+
+    ret = inode->ind[blocks - first];
+    lock_release(&inode->map_lock);
     return ret;
 }
 
-/*! List of open inodes, so that opening a single inode twice
-    returns the same `struct inode'. */
-static struct list open_inodes;
+/**
+ * Finds the extent of data that maps the given block and returns the sector
+ * holding it, storing in run how many sectors of the extent are left from
+ * there.  Extents map the file in order, so the extent's first block is the
+ * sum of the lengths of those before it; extents held in leaf blocks are
+ * found through the index.
+ */
+static block_sector_t extent_map(const struct inode_disk *data,
+                                 block_sector_t block, block_sector_t *run) {
+    const struct extent *extents = data->extents;
+    struct cache_block *index_block, *leaf_block = NULL;
+    struct extent_ref *refs;
+    block_sector_t first = 0, ret = 0;
+    uint32_t n, i, leaf;
+
+    ASSERT(block < data->sector_cnt);
+
+    n = data->extent_cnt < NUM_EXTENTS ? data->extent_cnt : NUM_EXTENTS;
+    for (i = 0; i < n; i++) {
+        if (block < first + extents[i].length)
+            break;
+        first += extents[i].length;
+    }
 
-/*! Initializes the inode module. */
-void inode_init(void) {
-    list_init(&open_inodes);
+    if (i == n) {
+        /* Past the extents in the inode.  Find the last leaf that starts at
+         * or before the block, then look in there. */
+        index_block = cache_read_block(data->extent_index);
+        refs = (struct extent_ref *) index_block->data;
+        leaf = CEIL(data->extent_cnt - NUM_EXTENTS, EXTENTS_PER_SECTOR) - 1;
+        while (leaf > 0 && refs[leaf].first > block)
+            leaf--;
+        first = refs[leaf].first;
+        leaf_block = cache_read_block(refs[leaf].leaf);
+        cache_read_end(index_block);
+
+        extents = (struct extent *) leaf_block->data;
+        n = data->extent_cnt - NUM_EXTENTS - leaf * EXTENTS_PER_SECTOR;
+        if (n > EXTENTS_PER_SECTOR)
+            n = EXTENTS_PER_SECTOR;
+        for (i = 0; i < n; i++) {
+            if (block < first + extents[i].length)
+                break;
+            first += extents[i].length;
+        }
+        ASSERT(i < n);
+    }
+
+    ret = extents[i].start + (block - first);
+    *run = extents[i].length - (block - first);
+    if (leaf_block != NULL)
+        cache_read_end(leaf_block);
+    return ret;
 }
 
-/* Allocates a direct block sector and clears the data.
- * Decreases the value of length by 1 block */
-bool allocate_direct(block_sector_t *sector, off_t *length) {
-    ASSERT(*length > 0);
-    ASSERT(*sector == 0);
-    if (!free_map_allocate(sector)) return false;
-    *length -= BLOCK_SECTOR_SIZE;
-    block_clear(fs_device, *sector);
+/**
+ * Returns a pointer to extent number idx of data, which the caller must hold
+ * locked.  If it is in a leaf block, locks the block for reading or writing
+ * as write says and stores it in leaf, otherwise sets leaf to NULL.  The
+ * caller should pass leaf to extent_done when finished with the extent.
+ */
+static struct extent *extent_at(const struct inode_disk *data, uint32_t idx,
+                                bool write, struct cache_block **leaf) {
+    struct cache_block *index_block;
+    block_sector_t leaf_sector;
+
+    if (idx < NUM_EXTENTS) {
+        *leaf = NULL;
+        return (struct extent *) &data->extents[idx];
+    }
+    idx -= NUM_EXTENTS;
+
+    index_block = cache_read_block(data->extent_index);
+    leaf_sector = ((struct extent_ref *) index_block->data)
+        [idx / EXTENTS_PER_SECTOR].leaf;
+    cache_read_end(index_block);
+
+    *leaf = write ? cache_write_block(leaf_sector)
+                  : cache_read_block(leaf_sector);
+    return (struct extent *) (*leaf)->data + idx % EXTENTS_PER_SECTOR;
+}
+
+/** Releases a leaf block returned by extent_at, if any. */
+static void extent_done(struct cache_block *leaf, bool write) {
+    if (leaf == NULL)
+        return;
+    if (write)
+        cache_write_end(leaf);
+    else
+        cache_read_end(leaf);
+}
+
+/**
+ * Adds the cnt sectors starting at start to the end of data, which the caller
+ * holds write locked, by lengthening the last extent if they continue it and
+ * by adding an extent otherwise.  Adds a leaf block, and the index block,
+ * when needed.  Returns true if successful.
+ */
+static bool extent_append(struct inode_disk *data, block_sector_t start,
+                          block_sector_t cnt) {
+    uint32_t idx = data->extent_cnt;
+    struct cache_block *leaf_block;
+    struct extent *e;
+
+    if (idx > 0) {
+        e = extent_at(data, idx - 1, true, &leaf_block);
+        if (e->start + e->length == start) {
+            e->length += cnt;
+            extent_done(leaf_block, true);
+            data->sector_cnt += cnt;
+            return true;
+        }
+        extent_done(leaf_block, false);
+    }
+
+    if (idx >= NUM_EXTENTS && (idx - NUM_EXTENTS) % EXTENTS_PER_SECTOR == 0) {
+        /* The extent starts a new leaf. */
+        uint32_t leaf = (idx - NUM_EXTENTS) / EXTENTS_PER_SECTOR;
+        struct cache_block *cache_block;
+        struct extent_ref *refs;
+        block_sector_t leaf_sector;
+
+        if (leaf >= LEAVES_PER_INDEX)
+            return false;
+        if (data->extent_index == 0) {
+            block_sector_t index_sector;
+            if (!free_map_allocate(&index_sector))
+                return false;
+            cache_write_end(cache_write_new(index_sector));
+            data->extent_index = index_sector;
+        }
+        if (!free_map_allocate(&leaf_sector))
+            return false;
+        cache_write_end(cache_write_new(leaf_sector));
+
+        cache_block = cache_write_block(data->extent_index);
+        refs = (struct extent_ref *) cache_block->data;
+        refs[leaf].first = data->sector_cnt;
+        refs[leaf].leaf = leaf_sector;
+        cache_write_end(cache_block);
+    }
+
+    e = extent_at(data, idx, true, &leaf_block);
+    e->start = start;
+    e->length = cnt;
+    extent_done(leaf_block, true);
+    /* Readers of the inode's copy may look at the count at any time. */
+    barrier();
+    data->extent_cnt++;
+    data->sector_cnt += cnt;
     return true;
 }
 
-/* Allocates an indirect block sector and as many direct sectors
- * are necessary to use up length. Decreases length by the amount
- * of space allocated. */
-bool allocate_indirect(block_sector_t *sector, off_t *length) {
-    ASSERT(*length > 0);
-    if (!free_map_allocate(sector)) return false;
-    unsigned i;
-    block_clear(fs_device, *sector);
-    struct cache_block *cache_block = cache_write_block(*sector);
-    block_sector_t *sectors = (block_sector_t*) cache_block->data;
-    for (i = 0; i < ENTRIES_PER_SECTOR; i++) {
-        if (!allocate_direct(sectors + i, length)) return false;
-        if (*length <= 0) break;
-    }   
-    cache_write_end(cache_block); 
+/**
+ * Adds num cleared sectors to the end of data, which the caller holds write
+ * locked, taking them from window in as few runs as the free map allows.
+ * A run that starts right after the file's last sector simply lengthens
+ * the last extent.  Returns true if successful.
+ */
+static bool extent_extend(struct inode_disk *data,
+                          struct free_map_window *window, block_sector_t num) {
+    block_sector_t start;
+    size_t got;
+
+    while (num > 0) {
+        if (!free_map_allocate_window(window, num, &start, &got))
+            return false;
+        extent_clear(start, got);
+        if (!extent_append(data, start, got)) {
+            free_map_release_run(start, got);
+            return false;
+        }
+        num -= got;
+    }
     return true;
 }
 
-/* Allocates a doubly indirect block sector and as many indirect sectors
- * are necessary to use up length. Decreases length by the amount
- * of space allocated. */
-bool allocate_double_indirect(block_sector_t *sector, off_t *length) {
-    ASSERT(*length > 0);
-    if (!free_map_allocate(sector)) return false;
-    unsigned i;
-    block_clear(fs_device, *sector);
-    struct cache_block *cache_block = cache_write_block(*sector);
-    block_sector_t *sectors = (block_sector_t*) cache_block->data;
-    for (i = 0; i < ENTRIES_PER_SECTOR; i++) {
-        if (!allocate_indirect(sectors + i, length)) return false;
-        if (*length <= 0) break;
-    }   
+/** Clears the cnt sectors starting at start in the cache, as file data, to
+ * be written back with whatever is written over them first. */
+static void extent_clear(block_sector_t start, block_sector_t cnt) {
+    for (; cnt > 0; start++, cnt--)
+        cache_write_data_end(cache_write_new(start));
+}
+
+/** Frees every sector of data's extents, along with the blocks holding the
+ * extents that don't fit in the inode. */
+static void extent_free(const struct inode_disk *data) {
+    struct cache_block *leaf_block, *index_block;
+    struct extent *e;
+    uint32_t i, leaves;
+
+    for (i = 0; i < data->extent_cnt; i++) {
+        e = extent_at(data, i, false, &leaf_block);
+        free_map_release_run(e->start, e->length);
+        extent_done(leaf_block, false);
+    }
+
+    if (data->extent_index == 0)
+        return;
+    leaves = data->extent_cnt > NUM_EXTENTS ?
+        CEIL(data->extent_cnt - NUM_EXTENTS, EXTENTS_PER_SECTOR) : 0;
+    index_block = cache_read_block(data->extent_index);
+    for (i = 0; i < leaves; i++)
+        free_map_release(((struct extent_ref *) index_block->data)[i].leaf);
+    cache_read_end(index_block);
+    free_map_release(data->extent_index);
+}
+
+/** Allocates one sector for a tree inode from its window. */
+static bool window_allocate(struct free_map_window *window,
+                            block_sector_t *sector) {
+    size_t cnt;
+    return free_map_allocate_window(window, 1, sector, &cnt);
+}
+
+/**
+ * Points inode's window, if empty, at the sector after the one holding the
+ * block before block, or, for extents, after the inode's last data sector.
+ * If there is no such sector, points it right after the inode.  The caller
+ * must hold the inode's extension_lock.
+ */
+static void window_aim(struct inode *inode, block_sector_t block) {
+    struct free_map_window *window = &inode->prealloc;
+    const struct inode_disk *data = &inode->data;
+    struct cache_block *leaf_block;
+    struct extent *last;
+    block_sector_t goal = inode->sector + 1, prev;
+
+    if (window->cnt > 0)
+        return;
+    if (data->magic == EXTENT_MAGIC) {
+        if (data->extent_cnt > 0) {
+            last = extent_at(data, data->extent_cnt - 1, false, &leaf_block);
+            goal = last->start + last->length;
+            extent_done(leaf_block, false);
+        }
+    } else if (block > 0 && (prev = tree_map(inode, block - 1)) != 0) {
+        goal = prev + 1;
+    }
+    free_map_window_init(window, goal);
+}
+
+/** Copies the in-memory inode of inode to its sector in the cache, so that it
+ * gets written back. */
+static void inode_store(const struct inode *inode) {
+    struct cache_block *cache_block = cache_write_block(inode->sector);
+    memcpy(cache_block->data, &inode->data, BLOCK_SECTOR_SIZE);
     cache_write_end(cache_block);
-    return true;
 }
 
-/* Allocates a direct block sector and clears the data. */
-bool grow_direct(block_sector_t *sector) {
+/*! Sets the layout of inodes created from now on. */
+void inode_set_layout(enum inode_layout layout) {
+    new_layout = layout;
+}
+
+/*! Returns the layout of the inode stored at SECTOR. */
+enum inode_layout inode_layout_at(block_sector_t sector) {
+    struct cache_block *cache_block = cache_read_block(sector);
+    unsigned magic = ((struct inode_disk *) cache_block->data)->magic;
+    cache_read_end(cache_block);
+    return magic == EXTENT_MAGIC ? INODE_LAYOUT_EXTENT : INODE_LAYOUT_TREE;
+}
+
+/*! Open inodes keyed by sector, so that opening a single inode twice
+    returns the same `struct inode'. */
+static struct hash open_inodes;
+/*! Protects open_inodes and the open_cnt and loading of every inode in
+    it. */
+static struct lock open_inodes_lock;
+/*! Signalled when an inode in open_inodes finishes loading. */
+static struct condition inode_loaded;
+
+/*! Statistics. */
+static size_t open_inode_cnt;           /*!< Inodes in open_inodes. */
+static size_t open_inode_peak;          /*!< Most there have been. */
+
+static unsigned inode_hash(const struct hash_elem *e, void *aux UNUSED);
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED);
+static struct inode *inode_reopen_open(struct inode *key);
+
+/*! Initializes the inode module. */
+void inode_init(void) {
+    lock_init(&open_inodes_lock);
+    cond_init(&inode_loaded);
+    if (!hash_init(&open_inodes, inode_hash, inode_less, NULL))
+        PANIC("Failed to allocate open inode table");
+}
+
+/*! Hashes an open inode by its sector. */
+static unsigned inode_hash(const struct hash_elem *e, void *aux UNUSED) {
+    return hash_int(hash_entry(e, struct inode, elem)->sector);
+}
+
+/*! Looks for an open inode with the sector of KEY, reopening and returning it
+    if found, once it has been read in, or returns a null pointer.  The caller
+    must hold open_inodes_lock. */
+static struct inode *inode_reopen_open(struct inode *key) {
+    struct hash_elem *e = hash_find(&open_inodes, &key->elem);
+    struct inode *inode;
+
+    if (e == NULL)
+        return NULL;
+    inode = hash_entry(e, struct inode, elem);
+    inode->open_cnt++;
+    while (inode->loading)
+        cond_wait(&inode_loaded, &open_inodes_lock);
+    return inode;
+}
+
+/*! Orders open inodes by sector. */
+static bool inode_less(const struct hash_elem *a, const struct hash_elem *b,
+                       void *aux UNUSED) {
+    return hash_entry(a, struct inode, elem)->sector <
+        hash_entry(b, struct inode, elem)->sector;
+}
+
+/* Allocates a direct block sector and clears the data in the cache, then
+ * points sector, which must be a hole, at it.  Data says whether it will hold
+ * file data, which is kept out of the journal, or indirect pointers.
+ * Return true if successful. */
+bool grow_direct(struct free_map_window *window, block_sector_t *sector, bool data) {
+    block_sector_t new_sector;
+    struct cache_block *cache_block;
+
     ASSERT(*sector == 0);
-    if (!free_map_allocate(sector)) return false;
-    block_clear(fs_device, *sector);
+    if (!window_allocate(window, &new_sector)) return false;
+    cache_block = cache_write_new(new_sector);
+    if (data)
+        cache_write_data_end(cache_block);
+    else
+        cache_write_end(cache_block);
+    // Readers may follow the pointer as soon as it is set
+    barrier();
+    *sector = new_sector;
     return true;
 }
 
 /* Allocates one direct block in the given indirect block at index.
- * Allocates the indirect block itself if index is 0.
+ * Allocates the indirect block itself if it is missing.
  * Return true if successful. */
-bool grow_indirect(block_sector_t *sector, block_sector_t index) {
-    if (index == 0) {
-        if (!grow_direct(sector)) return false;
+bool grow_indirect(struct free_map_window *window, block_sector_t *sector, block_sector_t index) {
+    if (*sector == 0) {
+        if (!grow_direct(window, sector, false)) return false;
     }
     struct cache_block *cache_block = cache_write_block(*sector);
     ASSERT(index < ENTRIES_PER_SECTOR);
     block_sector_t *sectors = (block_sector_t*) cache_block->data;
-    if (!grow_direct(sectors+index)) return false;
+    bool success = grow_direct(window, sectors+index, true);
     cache_write_end(cache_block);
-    return true;
+    return success;
 }
 
 /* Allocates one direct block in the given double indirect block at indexes.
- * Allocates the indirect block itself if index is 0.
+ * Allocates the indirect blocks themselves if they are missing.
  * Return true if successful. */
-bool grow_double_indirect(block_sector_t *sector, block_sector_t index1, block_sector_t index2) {
-    if (index1 == 0) {
-        if (!grow_direct(sector)) return false;
+bool grow_double_indirect(struct free_map_window *window, block_sector_t *sector,
+                          block_sector_t index1, block_sector_t index2) {
+    if (*sector == 0) {
+        if (!grow_direct(window, sector, false)) return false;
     }
     struct cache_block *cache_block = cache_write_block(*sector);
     ASSERT(index1 < ENTRIES_PER_SECTOR);
     block_sector_t *sectors = (block_sector_t*) cache_block->data;
-    if (!grow_indirect(sectors+index1, index2)) return false;
+    bool success = grow_indirect(window, sectors+index1, index2);
     cache_write_end(cache_block);
-    return true;
+    return success;
 }
 
-/** Frees a direct sector. Decreases length by the space freed. */
+/** Frees a direct sector, unless it is a hole. Decreases length by the
+ * space it covers. */
 void free_direct(block_sector_t sector, off_t *length) {
     ASSERT(*length > 0);
-    free_map_release(sector);
+    if (sector != 0)
+        free_map_release(sector);
     *length -= BLOCK_SECTOR_SIZE;
 }
 
 /** Frees up the indirect sector and as many direct sectors are 
  * necessary to use up length. Decreases length by the amount 
- * of space freed. */
+ * of space they cover, holes included. */
 void free_indirect(block_sector_t sector, off_t *length) {
     ASSERT(*length > 0);
+    if (sector == 0) {
+        *length -= ENTRIES_PER_SECTOR * BLOCK_SECTOR_SIZE;
+        return;
+    }
     struct cache_block *cache_block = cache_read_block(sector);
     unsigned i;
     block_sector_t *sectors = (block_sector_t*) cache_block->data;
@@ -243,6 +656,8 @@ void free_indirect(block_sector_t sector, off_t *length) {
  * of space freed. */
 void free_double_indirect(block_sector_t sector, off_t *length) {
     ASSERT(*length > 0);
+    if (sector == 0)
+        return;
     struct cache_block *cache_block = cache_read_block(sector);
     unsigned i;
     block_sector_t *sectors = (block_sector_t*) cache_block->data;
@@ -256,7 +671,7 @@ void free_double_indirect(block_sector_t sector, off_t *length) {
 
 /*! Initializes an inode with LENGTH bytes of data and
     writes the new inode to sector SECTOR on the file system
-    device.
+    device.  The data reads as zeros.
     Returns true if successful.
     Returns false if memory or disk allocation fails. */
 bool inode_create(block_sector_t sector, off_t length) {
@@ -266,72 +681,96 @@ bool inode_create(block_sector_t sector, off_t length) {
        one sector in size, and you should fix that. */
     ASSERT(sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
-    block_clear(fs_device, sector);
-    struct cache_block *cache_block = cache_write_block(sector);
-    unsigned i;
+    journal_begin();
+    struct cache_block *cache_block = cache_write_new(sector);
+    struct free_map_window window;
+    bool success = true;
 
     disk_inode = (struct inode_disk *) cache_block->data;
     disk_inode->length = length;
     disk_inode->magic = INODE_MAGIC;
 
-    // Allocate necessary direct nodes
-    for (i = 0; i < NUM_DIRECT; i++) {
-        if (length <= 0) {
-            break;
-        }
-        if (!allocate_direct(&disk_inode->direct[i], &length)) return false;
-    }
-
-    // Allocate necessary single indirect nodes
-    for (i = 0; i < NUM_SINGLE_INDIRECT; i++) {
-        if (length <= 0)
-            break;
-        if (!allocate_indirect(&disk_inode->single_indirect[i], &length)) return false;
+    // Tree inodes start out as one big hole
+    if (new_layout == INODE_LAYOUT_EXTENT) {
+        // Lay the data out right after the inode
+        free_map_window_init(&window, sector + 1);
+        disk_inode->magic = EXTENT_MAGIC;
+        success = extent_extend(disk_inode, &window,
+                                CEIL(length, BLOCK_SECTOR_SIZE));
+        free_map_window_release(&window);
+        // The caller only frees the inode sector, so give back the runs
+        // that were added before the disk filled up
+        if (!success)
+            extent_free(disk_inode);
     }
-
-    // Allocate a double indirect node if necessary
-    if (length > 0 && !allocate_double_indirect(&disk_inode->double_indirect, &length)) return false;
-
     cache_write_end(cache_block);
-    return true;
+    journal_end();
+    return success;
 }
 
 /*! Reads an inode from SECTOR
     and returns a `struct inode' that contains it.
     Returns a null pointer if memory allocation fails. */
 struct inode * inode_open(block_sector_t sector) {
-    struct list_elem *e;
-    struct inode *inode;
-    /* Check whether this inode is already open. */
-    for (e = list_begin(&open_inodes); e != list_end(&open_inodes);
-         e = list_next(e)) {
-        inode = list_entry(e, struct inode, elem);
-        if (inode->sector == sector) {
-            inode_reopen(inode);
-            return inode; 
-        }
-    }
+    struct inode *inode, *found;
+    struct cache_block *cache_block;
 
-    /* Allocate memory. */
+    /* Allocate memory.  It also serves as the key to look for the inode
+       among the open ones. */
     inode = malloc(sizeof *inode);
     if (inode == NULL)
         return NULL;
-
-    /* Initialize. */
-    list_push_front(&open_inodes, &inode->elem);
     inode->sector = sector;
+
+    /* Check whether this inode is already open. */
+    lock_acquire(&open_inodes_lock);
+    found = inode_reopen_open(inode);
+    if (found != NULL) {
+        lock_release(&open_inodes_lock);
+        free(inode);
+        return found;
+    }
+
+    /* Initialize and add it to the table, while still holding the lock, so
+       that anyone else opening it meanwhile waits for it to be read in
+       instead of reading it in a second time. */
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
+    inode->loading = true;
     lock_init(&inode->extension_lock);
+    lock_init(&inode->lock);
+    lock_init(&inode->map_lock);
+    inode->ind_first = 0;
+    inode->ind_cnt = 0;
+    inode->ra_next = 0;
+    inode->ra_end = 0;
+    inode->ra_window = READ_AHEAD_MIN;
+    free_map_window_init(&inode->prealloc, 0);
+    hash_insert(&open_inodes, &inode->elem);
+    if (++open_inode_cnt > open_inode_peak)
+        open_inode_peak = open_inode_cnt;
+    lock_release(&open_inodes_lock);
+
+    /* Read the inode in without holding the lock.  Nobody can change it
+       meanwhile, since they would have to open it first. */
+    cache_block = cache_read_block(sector);
+    memcpy(&inode->data, cache_block->data, BLOCK_SECTOR_SIZE);
+    cache_read_end(cache_block);
+
+    lock_acquire(&open_inodes_lock);
+    inode->loading = false;
+    cond_broadcast(&inode_loaded, &open_inodes_lock);
+    lock_release(&open_inodes_lock);
     return inode;
 }
 
 /*! Reopens and returns INODE. */
 struct inode * inode_reopen(struct inode *inode) {
     ASSERT(inode != NULL);
-    if (inode != NULL)
-        inode->open_cnt++;
+    lock_acquire(&open_inodes_lock);
+    inode->open_cnt++;
+    lock_release(&open_inodes_lock);
     return inode;
 }
 
@@ -348,18 +787,31 @@ void inode_close(struct inode *inode) {
     if (inode == NULL)
         return;
 
-    /* Release resources if this was the last opener. */
-    if (--inode->open_cnt == 0) {
-        /* Remove from inode list and release lock. */
-        list_remove(&inode->elem);
+    /* Release resources if this was the last opener.  Once out of the
+       table, nobody else can get at it. */
+    lock_acquire(&open_inodes_lock);
+    bool last = --inode->open_cnt == 0;
+    if (last) {
+        hash_delete(&open_inodes, &inode->elem);
+        open_inode_cnt--;
+    }
+    lock_release(&open_inodes_lock);
+
+    if (last) {
+        /* Nobody is left to grow the file. */
+        free_map_window_release(&inode->prealloc);
  
         /* Deallocate blocks if removed. */
         if (inode->removed) {
-            struct cache_block *cache_block = cache_read_block(inode->sector);
-            struct inode_disk *disk_inode = (struct inode_disk *) cache_block->data;
+            journal_begin();
+            struct inode_disk *disk_inode = &inode->data;
             unsigned i;
 
             off_t length = disk_inode->length;
+            if (disk_inode->magic == EXTENT_MAGIC) {
+                extent_free(disk_inode);
+                length = 0;
+            }
             for (i = 0; i < NUM_DIRECT; i++) {
                 if (length <= 0) break;
                 free_direct(disk_inode->direct[i], &length);
@@ -372,8 +824,8 @@ void inode_close(struct inode *inode) {
         
             // Allocate a double indirect node if necessary
             if (length > 0) free_double_indirect(disk_inode->double_indirect, &length);
-            cache_read_end(cache_block); 
             free_map_release(inode->sector);
+            journal_end();
         }
         free(inode); 
     }
@@ -388,18 +840,16 @@ void inode_remove(struct inode *inode) {
 
 /** Get the length of data the inode contains. */
 off_t inode_length(const struct inode *inode) {
-    struct cache_block *cache_block = cache_read_block(inode->sector);
-    off_t len = ((struct inode_disk*) cache_block->data)->length;
-    cache_read_end(cache_block);
-    return len;
+    return inode->data.length;
 }
 
-/** Set the length of data the inode contains. */
-void inode_set_length(const struct inode *inode, off_t length) {
-    struct cache_block *cache_block = cache_write_block(inode->sector);
-    struct inode_disk* inode_disk = (struct inode_disk*) cache_block->data;
-    inode_disk->length = length;
-    cache_write_end(cache_block);
+/** Set the length of data the inode contains.  The caller must hold the
+ * inode's extension_lock. */
+void inode_set_length(struct inode *inode, off_t length) {
+    /* Make the data mapped by the new length visible first. */
+    barrier();
+    inode->data.length = length;
+    inode_store(inode);
 }
 
 /*! Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -409,10 +859,13 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
     uint8_t *buffer = buffer_;
     struct cache_block *cache_block;
     off_t bytes_read = 0;
+    bool sequential = offset == inode->ra_next;
+    int ra_hits = 0, ra_misses = 0;
+    /* Disk sector to read and how many follow it on disk in the file. */
+    block_sector_t sector_idx = 0, run = 0;
 
     while (size > 0) {
-        /* Disk sector to read, starting byte offset within sector. */
-        block_sector_t sector_idx = byte_to_sector (inode, offset);
+        /* Starting byte offset within sector. */
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -424,63 +877,183 @@ off_t inode_read_at(struct inode *inode, void *buffer_, off_t size, off_t offset
         int chunk_size = size < min_left ? size : min_left;
         if (chunk_size <= 0)
             break;
-            
-        /* Load data into cache. */
-        cache_block = cache_read_block(sector_idx);
-        
-        /* Copy from cache into caller's buffer. */
-        memcpy(buffer + bytes_read, cache_block->data + sector_ofs, chunk_size);
-        cache_read_end(cache_block);
+
+        /* Look the sector up only when we run off the end of a run. */
+        if (run == 0)
+            sector_idx = inode_map(inode, offset, &run);
+
+        if (sector_idx == 0) {
+            /* Holes read as zeros. */
+            memset(buffer + bytes_read, 0, chunk_size);
+        } else {
+            /* Load data into cache. */
+            cache_block = cache_read_block(sector_idx);
+
+            /* Keep score of how well reading ahead is working.  Sectors we
+             * asked for that are no longer cached were evicted before we got
+             * to them. */
+            if (cache_take_prefetched(cache_block))
+                ra_hits++;
+            else if (sequential && sector_ofs == 0 && offset < inode->ra_end)
+                ra_misses++;
+
+            /* Copy from cache into caller's buffer. */
+            memcpy(buffer + bytes_read, cache_block->data + sector_ofs,
+                   chunk_size);
+            cache_read_end(cache_block);
+        }
       
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_read += chunk_size;
+        if (offset % BLOCK_SECTOR_SIZE == 0) {
+            if (sector_idx != 0)
+                sector_idx++;
+            run--;
+        }
     }
 
+    inode_read_ahead(inode, sequential, offset, ra_hits, ra_misses);
     return bytes_read;
 }
 
-/** Allocates and clears an additional sector for the inode
- * to occupy. Does not update the inode length, the caller should
- * do that after writing is finished. Returns true if successful. */
+/** Called after a read from INODE that stopped at END.  If the read picked up
+ * where the previous one left off, it is part of a sequential stream: resize
+ * the stream's prefetch window according to how many of the sectors it
+ * prefetched were still cached (HITS) or already evicted (MISSES), and queue
+ * the sectors of the window that haven't been queued yet. */
+static void inode_read_ahead(struct inode *inode, bool sequential, off_t end,
+                             int hits, int misses) {
+    off_t length, limit, pos;
+
+    inode->ra_next = end;
+    if (!sequential) {
+        /* Random access; forget the old stream. */
+        inode->ra_end = end;
+        inode->ra_window = READ_AHEAD_MIN;
+        return;
+    }
+
+    /* Back off if prefetched sectors are being thrown away before they're
+     * read, otherwise keep reaching further ahead. */
+    if (misses > 0)
+        inode->ra_window = inode->ra_window / 2 > READ_AHEAD_MIN ?
+            inode->ra_window / 2 : READ_AHEAD_MIN;
+    else if (hits > 0)
+        inode->ra_window = inode->ra_window * 2 < READ_AHEAD_MAX ?
+            inode->ra_window * 2 : READ_AHEAD_MAX;
+
+    /* Queue the window a run of sectors at a time. */
+    length = inode_length(inode);
+    limit = end + (off_t) inode->ra_window * BLOCK_SECTOR_SIZE;
+    if (limit > length)
+        limit = length;
+    pos = inode->ra_end > end ? inode->ra_end : end;
+    pos = ROUND_UP(pos, BLOCK_SECTOR_SIZE);
+    while (pos < limit) {
+        block_sector_t run, sector = inode_map(inode, pos, &run);
+        block_sector_t left = CEIL(limit - pos, BLOCK_SECTOR_SIZE);
+        if (run > left)
+            run = left;
+        if (sector != 0)
+            cache_read_ahead(sector, run);
+        pos += (off_t) run * BLOCK_SECTOR_SIZE;
+    }
+    inode->ra_end = pos;
+}
+
+/** Makes room for num more sectors at the end of the inode.  Extents
+ * allocate and clear them now; the tree leaves them as holes, to be filled
+ * by inode_fill when they are written.  Does not update the inode length,
+ * the caller should do that after writing is finished. Returns true if
+ * successful. */
 bool inode_extend(struct inode* inode, block_sector_t num) {
     
-    // Get the main node data from cache
-    struct cache_block *cache_block = cache_write_block(inode->sector);
-    struct inode_disk *data = (struct inode_disk *)cache_block->data;
+    // Readers go on using the copy while it grows
+    struct inode_disk *data = &inode->data;
     ASSERT(is_valid_inode(data));
 
-    block_sector_t num_blocks = CEIL(data->length, BLOCK_SECTOR_SIZE) - 1;
-    bool success = true;
+    if (data->magic != EXTENT_MAGIC)
+        return true;
 
-    while (num > 0 && success) {
-        num_blocks += 1;
-        num -= 1;
+    // Keep growing from where the file ends
+    window_aim(inode, 0);
 
-        block_sector_t blocks = num_blocks;
+    // Extents already know how many sectors they map, which may be more
+    // than the length covers if an earlier extension failed part way.
+    block_sector_t want = CEIL(data->length, BLOCK_SECTOR_SIZE) + num;
+    bool success = want <= data->sector_cnt ||
+        extent_extend(data, &inode->prealloc, want - data->sector_cnt);
+    inode_store(inode);
+    return success;
+}
 
-        // Check it its in the direct nodes
-        if (blocks < NUM_DIRECT) {
-            success &= grow_direct(&data->direct[blocks]);
-            continue;
-        } 
-        // Otherwise, skip over them
-        blocks -= NUM_DIRECT;
-    
-        off_t single = blocks / ENTRIES_PER_SECTOR; 
-        blocks = blocks % ENTRIES_PER_SECTOR;
-    
-        // Check if it fits in the single indirect nodes.
-        if (single < NUM_SINGLE_INDIRECT) {
-            success &= grow_indirect(&data->single_indirect[single], blocks);
-            continue;
+/** Allocates cleared sectors for the holes of the inode between pos and end,
+ * in journaled operations of GROW_OP_SECTORS blocks each, taking the inode's
+ * extension_lock unless the caller holds it already.  Returns false if the
+ * disk filled up first. */
+static bool inode_fill(struct inode *inode, off_t pos, off_t end) {
+    bool held = lock_held_by_current_thread(&inode->extension_lock);
+    block_sector_t first = pos / BLOCK_SECTOR_SIZE, block, run;
+    block_sector_t last = CEIL(end, BLOCK_SECTOR_SIZE);
+    bool success = true;
+
+    if (!held)
+        lock_acquire(&inode->extension_lock);
+    journal_begin();
+    for (block = first; block < last && success; block++) {
+        if (block % GROW_OP_SECTORS == 0 && block > first) {
+            inode_store(inode);
+            journal_end();
+            journal_begin();
         }
+        if (inode_map(inode, block * BLOCK_SECTOR_SIZE, &run) == 0) {
+            window_aim(inode, block);
+            success = tree_fill(inode, block);
+        }
+    }
+    inode_store(inode);
+    journal_end();
+    if (!held)
+        lock_release(&inode->extension_lock);
+    return success;
+}
+
+/** Allocates a cleared sector for block of the inode, which must be a hole
+ * of a tree inode, along with the indirect blocks leading to it that are
+ * missing.  Returns true if successful. */
+static bool tree_fill(struct inode *inode, block_sector_t block) {
+    struct inode_disk *data = &inode->data;
+    struct free_map_window *window = &inode->prealloc;
+    block_sector_t single;
+    bool success;
+
+    ASSERT(data->magic == INODE_MAGIC);
+
+    // Check it its in the direct nodes
+    if (block < NUM_DIRECT)
+        return grow_direct(window, &data->direct[block], true);
+    // Otherwise, skip over them
+    block -= NUM_DIRECT;
+
+    single = block / ENTRIES_PER_SECTOR; 
+    block = block % ENTRIES_PER_SECTOR;
+
+    // Check if it fits in the single indirect nodes.
+    if (single < NUM_SINGLE_INDIRECT) {
+        success = grow_indirect(window, &data->single_indirect[single], block);
+    } else {
         // Skip over single indirects
-        single-= NUM_SINGLE_INDIRECT;
-        success &= grow_double_indirect(&data->double_indirect, single, blocks);
+        single -= NUM_SINGLE_INDIRECT;
+        success = grow_double_indirect(window, &data->double_indirect, single,
+                                       block);
     }
-    cache_write_end(cache_block);
+
+    // The copy of the indirect entries may hold the hole
+    lock_acquire(&inode->map_lock);
+    inode->ind_cnt = 0;
+    lock_release(&inode->map_lock);
     return success;
 }
 
@@ -491,29 +1064,25 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t
     const uint8_t *buffer = buffer_;
     struct cache_block *cache_block;
     off_t bytes_written = 0;
-    bool locked = false;
+    bool locked;
     off_t newlen = size + offset;
 
     if (inode->deny_write_cnt)
         return 0;
-    
-    // Check if this is file extension, and if so, 
-    // acquire the lock and allocate extra space
-    if (newlen >= inode_length(inode)) {
-        lock_acquire(&inode->extension_lock);        
-        if (size + offset >= inode_length(inode)) {
-            locked = true;
-            int blocks_needed = CEIL(size + offset, BLOCK_SECTOR_SIZE) - 
-                CEIL(inode_length(inode), BLOCK_SECTOR_SIZE);
-            if (!inode_extend(inode, blocks_needed)) return 0;
-        } else {
-            lock_release(&inode->extension_lock);
-        }
-    }
+    if (!inode_write_prepare(inode, newlen, &locked))
+        return 0;
 
     while (size > 0) {
-        /* Sector to write, starting byte offset within sector. */
+        /* Sector to write, starting byte offset within sector.  Fill in the
+           holes for the rest of the write on finding one.  If the disk
+           fills up, write as far as the blocks that were filled reach. */
         block_sector_t sector_idx = byte_to_sector(inode, offset);
+        if (sector_idx == 0) {
+            inode_fill(inode, offset, newlen);
+            sector_idx = byte_to_sector(inode, offset);
+            if (sector_idx == 0)
+                break;
+        }
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -536,12 +1105,127 @@ off_t inode_write_at(struct inode *inode, const void *buffer_, off_t size, off_t
         bytes_written += chunk_size;
     }
 
+    inode_write_done(inode, offset, locked);
+    return bytes_written;
+}
+
+/** Makes room in inode for a write that ends at newlen.  If the file has to
+ * grow, allocates the sectors and returns holding the inode's
+ * extension_lock, with locked set, so that the write can be finished by
+ * inode_write_done.  Returns false if the file could not grow. */
+static bool inode_write_prepare(struct inode *inode, off_t newlen,
+                                bool *locked) {
+    *locked = false;
+
+    // Check if this is file extension, and if so, 
+    // acquire the lock and allocate extra space
+    if (newlen >= inode_length(inode)) {
+        lock_acquire(&inode->extension_lock);        
+        if (newlen >= inode_length(inode)) {
+            *locked = true;
+            int blocks_needed = CEIL(newlen, BLOCK_SECTOR_SIZE) - 
+                CEIL(inode_length(inode), BLOCK_SECTOR_SIZE);
+            bool extended = true;
+            // Grow a bounded number of sectors per journaled operation;
+            // each call covers the sectors the ones before it added.
+            int num = 0;
+            while (extended && num < blocks_needed) {
+                num = blocks_needed - num > GROW_OP_SECTORS ?
+                    num + GROW_OP_SECTORS : blocks_needed;
+                journal_begin();
+                extended = inode_extend(inode, num);
+                journal_end();
+            }
+            if (!extended) {
+                lock_release(&inode->extension_lock);
+                return false;
+            }
+        } else {
+            lock_release(&inode->extension_lock);
+        }
+    }
+    return true;
+}
+
+/** Finishes a write prepared by inode_write_prepare that got as far as
+ * newlen. */
+static void inode_write_done(struct inode *inode, off_t newlen, bool locked) {
     if (locked) {
+        if (newlen < inode_length(inode))
+            newlen = inode_length(inode);
         // Set the new length to allow reading
+        journal_begin();
         inode_set_length(inode, newlen);
+        journal_end();
         lock_release(&inode->extension_lock);
     }
-    return bytes_written;
+}
+
+/*! Reads up to CNT whole sectors of INODE, starting at OFFSET, which must be
+    a multiple of BLOCK_SECTOR_SIZE, into BUFFERS, one sector apiece.  Sectors
+    that are not in the buffer cache are read from disk straight into BUFFERS,
+    as many at a time as lie together on disk.  Stops at the last whole sector
+    of the file.  Holes read as zeros.  Returns the number of bytes read. */
+off_t inode_read_sectors(struct inode *inode, void *const buffers[],
+                         size_t cnt, off_t offset) {
+    off_t length = inode_length(inode);
+    size_t done = 0;
+
+    ASSERT(offset % BLOCK_SECTOR_SIZE == 0);
+    if (offset >= length)
+        return 0;
+    if (cnt > (size_t) (length - offset) / BLOCK_SECTOR_SIZE)
+        cnt = (length - offset) / BLOCK_SECTOR_SIZE;
+
+    while (done < cnt) {
+        off_t pos = offset + (off_t) done * BLOCK_SECTOR_SIZE;
+        block_sector_t run, sector = inode_map(inode, pos, &run), i;
+        if (run > cnt - done)
+            run = cnt - done;
+        if (sector != 0)
+            cache_read_direct(sector, run, buffers + done);
+        else
+            for (i = 0; i < run; i++)
+                memset(buffers[done + i], 0, BLOCK_SECTOR_SIZE);
+        done += run;
+    }
+    return (off_t) done * BLOCK_SECTOR_SIZE;
+}
+
+/*! Writes CNT whole sectors from BUFFERS, one sector apiece, into INODE,
+    starting at OFFSET, which must be a multiple of BLOCK_SECTOR_SIZE, and
+    extends the file if necessary.  Sectors that are not in the buffer cache
+    are written to disk straight from BUFFERS.  Returns the number of bytes
+    written, which may be less than asked for if an error occurs. */
+off_t inode_write_sectors(struct inode *inode, const void *const buffers[],
+                          size_t cnt, off_t offset) {
+    off_t newlen = offset + (off_t) cnt * BLOCK_SECTOR_SIZE;
+    size_t done = 0;
+    bool locked;
+
+    ASSERT(offset % BLOCK_SECTOR_SIZE == 0);
+    if (inode->deny_write_cnt)
+        return 0;
+    if (!inode_write_prepare(inode, newlen, &locked))
+        return 0;
+
+    while (done < cnt) {
+        off_t pos = offset + (off_t) done * BLOCK_SECTOR_SIZE;
+        block_sector_t run, sector = inode_map(inode, pos, &run);
+        if (sector == 0) {
+            inode_fill(inode, pos, newlen);
+            sector = inode_map(inode, pos, &run);
+            if (sector == 0)
+                break;
+        }
+        if (run > cnt - done)
+            run = cnt - done;
+        cache_write_direct(sector, run, buffers + done);
+        done += run;
+    }
+
+    inode_write_done(inode, offset + (off_t) done * BLOCK_SECTOR_SIZE, locked);
+    return (off_t) done * BLOCK_SECTOR_SIZE;
 }
 
 /*! Disables writes to INODE.
@@ -560,7 +1244,32 @@ void inode_allow_write (struct inode *inode) {
     inode->deny_write_cnt--;
 }
 
+/*! Locks INODE for its user, such as a directory changing its entries, for
+    changes that take more than one write.  The inode module never takes
+    this lock itself. */
+void inode_lock(struct inode *inode) {
+    lock_acquire(&inode->lock);
+}
+
+/*! Releases the lock taken by inode_lock(). */
+void inode_unlock(struct inode *inode) {
+    lock_release(&inode->lock);
+}
+
+/*! Returns true if the running thread holds INODE's inode_lock(). */
+bool inode_lock_held(const struct inode *inode) {
+    return lock_held_by_current_thread(&inode->lock);
+}
+
 /* Checks is inode is also opened in another place */
 bool inode_is_shared(struct inode* inode){
-    return inode->open_cnt > 1;
+    lock_acquire(&open_inodes_lock);
+    bool shared = inode->open_cnt > 1;
+    lock_release(&open_inodes_lock);
+    return shared;
+}
+
+/*! Prints the number of open inodes. */
+void inode_print_stats(void) {
+    printf("Inodes: %zu open, %zu at most\n", open_inode_cnt, open_inode_peak);
 }
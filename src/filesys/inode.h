@@ -7,7 +7,15 @@
 
 struct bitmap;
 
+/*! How an inode finds its data blocks on disk. */
+enum inode_layout {
+    INODE_LAYOUT_TREE,          /*!< Direct, indirect and doubly indirect. */
+    INODE_LAYOUT_EXTENT         /*!< Runs of consecutive sectors. */
+};
+
 void inode_init(void);
+void inode_set_layout(enum inode_layout);
+enum inode_layout inode_layout_at(block_sector_t);
 bool inode_create(block_sector_t, off_t);
 struct inode *inode_open(block_sector_t);
 struct inode *inode_reopen(struct inode *);
@@ -16,11 +24,19 @@ void inode_close(struct inode *);
 void inode_remove(struct inode *);
 off_t inode_read_at(struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at(struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_sectors(struct inode *, void *const buffers[], size_t cnt,
+                         off_t offset);
+off_t inode_write_sectors(struct inode *, const void *const buffers[],
+                          size_t cnt, off_t offset);
 void inode_deny_write(struct inode *);
 void inode_allow_write(struct inode *);
 off_t inode_length(const struct inode *);
-void inode_set_length(const struct inode *, off_t);
+void inode_set_length(struct inode *, off_t);
 bool inode_extend(struct inode*, block_sector_t);
 bool inode_is_shared(struct inode*);
+void inode_lock(struct inode *);
+void inode_unlock(struct inode *);
+bool inode_lock_held(const struct inode *);
+void inode_print_stats(void);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,233 @@
+#include "filesys/journal.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/cache.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/*! Write-ahead journal for metadata.
+
+    Changes to inodes, indirect and extent blocks, directories and the free
+    map are made in the buffer cache inside operations bracketed by
+    journal_begin() and journal_end().  Blocks dirtied inside an operation
+    are marked as metadata and are never written in place on their own.
+    Instead the cache flusher commits them as a group.  It freezes new
+    operations and waits for running ones to finish, so that the metadata
+    is consistent.  Then it writes:
+
+    1. the file data, in place;
+    2. the home sector of each metadata block and a copy of the block, into
+       the journal;
+    3. the header, with the number of blocks, which commits the
+       transaction;
+    4. the metadata blocks, in place;
+    5. the header again, emptied.
+
+    Each step waits for the one before it.  After a crash, filesys_init()
+    calls journal_open(), which copies a committed transaction back to its
+    home sectors.  A transaction is either wholly on disk or not at all, so
+    the file system never points at blocks it has not allocated and never
+    allocates blocks it still points at.  Sectors freed by a transaction
+    are only handed out again once it has committed, see free-map.c.
+
+    Metadata stays in the cache until it is committed, so it must fit in
+    the journal and leave the cache room for everything else.  Each
+    operation may dirty up to JOURNAL_OP_BLOCKS blocks of it.
+    journal_begin() sets room for that many aside, and commits what is
+    dirty first if there is not enough.  Longer changes, such as filling in
+    a large file, are broken into several operations, each of which leaves
+    the file system consistent. */
+
+/*! Identifies the journal header. */
+#define JOURNAL_MAGIC 0x4a524e4c
+
+/*! Journal header, at JOURNAL_SECTOR.  Must be BLOCK_SECTOR_SIZE bytes. */
+struct journal_header {
+    unsigned magic;                     /*!< JOURNAL_MAGIC. */
+    uint32_t seq;                       /*!< Transactions committed. */
+    uint32_t cnt;                       /*!< Blocks in the journal, 0 if
+                                             none need replaying. */
+    uint8_t unused[BLOCK_SECTOR_SIZE - 12];
+};
+
+/*! Where the list of home sectors and the block copies go. */
+#define JOURNAL_LIST_SECTOR (JOURNAL_SECTOR + 1)
+#define JOURNAL_DATA_SECTOR (JOURNAL_SECTOR + 2)
+
+static bool enabled;                    /*!< Disk has a journal. */
+static struct journal_header header;    /*!< Copy of the header on disk. */
+static block_sector_t list[JOURNAL_BLOCKS]; /*!< Home sectors. */
+
+/*! Operations under way, and whether the flusher is waiting for them. */
+static struct lock journal_lock;
+static int active_cnt;
+static bool frozen;
+static struct condition op_ended;       /*!< Signalled as each op ends. */
+static struct condition thawed;         /*!< Signalled when frozen clears. */
+
+/*! Statistics. */
+static unsigned long long commit_cnt;   /*!< Transactions committed. */
+static unsigned long long block_cnt;    /*!< Blocks they held. */
+
+static void journal_write_header(uint32_t cnt);
+
+/*! Initializes the journal module. */
+void journal_init(void) {
+    lock_init(&journal_lock);
+    cond_init(&op_ended);
+    cond_init(&thawed);
+}
+
+/*! Writes an empty journal to a newly formatted disk and starts using it. */
+void journal_create(void) {
+    memset(&header, 0, sizeof header);
+    header.magic = JOURNAL_MAGIC;
+    journal_write_header(0);
+    enabled = true;
+}
+
+/*! Looks for a journal on the file system device and, if there is one,
+    replays the transaction left in it, if any.  Must be called before
+    anything is read through the buffer cache. */
+void journal_open(void) {
+    static uint8_t copy[BLOCK_SECTOR_SIZE];
+    uint32_t i;
+
+    ASSERT(sizeof header == BLOCK_SECTOR_SIZE);
+    block_read(fs_device, JOURNAL_SECTOR, &header);
+    enabled = header.magic == JOURNAL_MAGIC;
+    if (!enabled || header.cnt == 0)
+        return;
+    if (header.cnt > JOURNAL_BLOCKS)
+        PANIC("journal header claims %"PRIu32" blocks", header.cnt);
+
+    printf("Replaying %"PRIu32" journaled blocks...", header.cnt);
+    block_read(fs_device, JOURNAL_LIST_SECTOR, list);
+    for (i = 0; i < header.cnt; i++) {
+        block_read(fs_device, JOURNAL_DATA_SECTOR + i, copy);
+        block_write(fs_device, list[i], copy);
+    }
+    journal_write_header(0);
+    printf("done.\n");
+}
+
+/*! Returns true if the file system has a journal. */
+bool journal_enabled(void) {
+    return enabled;
+}
+
+/*! Starts an operation on metadata.  Operations nest; only the outermost
+    one can wait, for a commit to finish or for room in the cache for the
+    metadata it will dirty.  If the metadata already dirty leaves no room,
+    and no other operation is running whose end would help, commits it.
+    Must not be called while holding a cache block. */
+void journal_begin(void) {
+    struct thread *t = thread_current();
+
+    if (t->journal_depth > 0 || !enabled) {
+        t->journal_depth++;
+        return;
+    }
+    lock_acquire(&journal_lock);
+    for (;;) {
+        if (frozen) {
+            cond_wait(&thawed, &journal_lock);
+        } else if (cache_meta_fits((active_cnt + 1) * JOURNAL_OP_BLOCKS)) {
+            break;
+        } else if (active_cnt > 0) {
+            cond_wait(&op_ended, &journal_lock);
+        } else {
+            lock_release(&journal_lock);
+            refresh_cache();
+            lock_acquire(&journal_lock);
+        }
+    }
+    active_cnt++;
+    lock_release(&journal_lock);
+    t->journal_depth++;
+}
+
+/*! Ends an operation started with journal_begin(). */
+void journal_end(void) {
+    ASSERT(thread_current()->journal_depth > 0);
+    if (--thread_current()->journal_depth > 0 || !enabled)
+        return;
+    lock_acquire(&journal_lock);
+    active_cnt--;
+    cond_broadcast(&op_ended, &journal_lock);
+    lock_release(&journal_lock);
+}
+
+/*! Returns true if the running thread is inside an operation, so that the
+    blocks it dirties are metadata. */
+bool journal_in_op(void) {
+    return thread_current()->journal_depth > 0;
+}
+
+/*! Keeps new operations from starting and waits for the running ones to
+    end, so that the metadata in the cache is consistent.  Blocks the
+    caller dirties until journal_thaw() count as metadata.  Returns false,
+    doing nothing, if there is no journal.  Must not be called inside an
+    operation. */
+bool journal_freeze(void) {
+    ASSERT(!journal_in_op());
+    if (!enabled)
+        return false;
+    lock_acquire(&journal_lock);
+    frozen = true;
+    while (active_cnt > 0)
+        cond_wait(&op_ended, &journal_lock);
+    lock_release(&journal_lock);
+    thread_current()->journal_depth++;
+    return true;
+}
+
+/*! Lets operations run again after journal_freeze(). */
+void journal_thaw(void) {
+    thread_current()->journal_depth--;
+    lock_acquire(&journal_lock);
+    frozen = false;
+    cond_broadcast(&thawed, &journal_lock);
+    lock_release(&journal_lock);
+}
+
+/*! Writes the CNT read-locked metadata BLOCKS into the journal and commits
+    them.  The caller then writes them in place and calls journal_clear(). */
+void journal_write(struct cache_block **blocks, size_t cnt) {
+    const void *buffers[1 + JOURNAL_BLOCKS];
+    size_t i;
+
+    ASSERT(cnt > 0 && cnt <= JOURNAL_BLOCKS);
+    for (i = 0; i < cnt; i++) {
+        list[i] = blocks[i]->sector;
+        buffers[1 + i] = blocks[i]->data;
+    }
+    buffers[0] = list;
+    block_write_vector(fs_device, JOURNAL_LIST_SECTOR, buffers, 1 + cnt);
+
+    header.seq++;
+    journal_write_header(cnt);
+    commit_cnt++;
+    block_cnt += cnt;
+}
+
+/*! Marks the journal empty once the committed blocks are in place. */
+void journal_clear(void) {
+    journal_write_header(0);
+}
+
+/*! Writes the header with CNT blocks to replay. */
+static void journal_write_header(uint32_t cnt) {
+    header.cnt = cnt;
+    block_write(fs_device, JOURNAL_SECTOR, &header);
+}
+
+/*! Prints journal statistics. */
+void journal_print_stats(void) {
+    if (enabled)
+        printf("Journal: %llu transactions, %llu blocks\n",
+               commit_cnt, block_cnt);
+}
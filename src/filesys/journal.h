@@ -0,0 +1,34 @@
+#ifndef FILESYS_JOURNAL_H
+#define FILESYS_JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+struct cache_block;
+
+/*! Most blocks one transaction can hold. */
+#define JOURNAL_BLOCKS (BLOCK_SECTOR_SIZE / sizeof (block_sector_t))
+/*! Sectors the journal takes up, starting at JOURNAL_SECTOR: a header, the
+    list of home sectors, and a copy of each block. */
+#define JOURNAL_SECTORS (2 + JOURNAL_BLOCKS)
+/*! Most metadata blocks one operation may dirty, free map aside.  Room for
+    this many is set aside for each operation while it runs. */
+#define JOURNAL_OP_BLOCKS 16
+
+void journal_init(void);
+void journal_create(void);
+void journal_open(void);
+bool journal_enabled(void);
+
+void journal_begin(void);
+void journal_end(void);
+bool journal_in_op(void);
+
+bool journal_freeze(void);
+void journal_thaw(void);
+void journal_write(struct cache_block **blocks, size_t cnt);
+void journal_clear(void);
+void journal_print_stats(void);
+
+#endif /* filesys/journal.h */
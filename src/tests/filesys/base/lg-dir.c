@@ -0,0 +1,46 @@
+/* Creates 10,000 empty files in one directory, opens each of
+   them by name, then looks up names that aren't there.  With a
+   hashed directory each lookup reads a slot or two instead of
+   scanning every entry before it, so lg-dir.ck bounds the buffer
+   cache lookups by a small constant per operation; a directory
+   scanned entry by entry needs tens of millions. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 10000
+
+void
+test_main (void) 
+{
+  char name[16];
+  int i, fd;
+
+  msg ("create %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("open %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "f%d", i);
+      fd = open (name);
+      if (fd < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+
+  msg ("open %d missing files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      snprintf (name, sizeof name, "g%d", i);
+      if (open (name) != -1)
+        fail ("open \"%s\" succeeded", name);
+    }
+}
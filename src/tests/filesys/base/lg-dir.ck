@@ -0,0 +1,27 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-dir) begin
+(lg-dir) create 10000 files
+(lg-dir) open 10000 files
+(lg-dir) open 10000 missing files
+(lg-dir) end
+EOF
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($lookups) = map (/^Cache: (\d+) lookups/, @output)
+  or fail "missing \"Cache:\" statistics\n";
+
+# 10,000 creates, 10,000 opens and 10,000 failed opens, each of which
+# should probe a few slots of the directory's table and touch a few
+# other sectors.  Allow 64 lookups apiece.
+my ($op_cnt) = 3 * 10000;
+fail "$lookups cache lookups for $op_cnt directory operations: "
+  . "lookups do not grow linearly with the directory\n"
+  if $lookups > $op_cnt * 64;
+
+pass sprintf ("%d cache lookups for %d directory operations, "
+              . "%.1f apiece\n", $lookups, $op_cnt, $lookups / $op_cnt);
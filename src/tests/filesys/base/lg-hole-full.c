@@ -0,0 +1,73 @@
+/* Seeks far past the end of an empty file and writes until the
+   disk fills up.  Every write lands in a hole, which the file
+   system has to fill in with new sectors first.  When the disk
+   runs out partway through a write, the sectors it did get must
+   take the start of that write, so that the file is as long as
+   the bytes write() reported and a further write finds no space
+   left over. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define START 65536
+#define CHUNK_SIZE 8192
+
+static char chunk[CHUNK_SIZE];
+static char block[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "hole";
+  size_t total = 0, ofs;
+  int fd, n, i;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("seek \"%s\" to %d", file_name, START);
+  seek (fd, START);
+
+  msg ("write \"%s\" until the disk is full", file_name);
+  for (i = 0; ; i++) 
+    {
+      memset (chunk, 'a' + i % 26, sizeof chunk);
+      n = write (fd, chunk, sizeof chunk);
+      if (n < 0 || n > (int) sizeof chunk)
+        fail ("write returned %d", n);
+      total += n;
+      if (n < (int) sizeof chunk)
+        break;
+    }
+  if (total == 0)
+    fail ("disk full before the first write");
+
+  CHECK (write (fd, chunk, sizeof chunk) == 0,
+         "write \"%s\" on full disk writes nothing", file_name);
+  CHECK (filesize (fd) == START + (int) total,
+         "size of \"%s\" matches bytes written", file_name);
+
+  msg ("verify \"%s\"", file_name);
+  seek (fd, 0);
+  memset (chunk, 0, sizeof chunk);
+  for (ofs = 0; ofs < START; ofs += sizeof block) 
+    {
+      if (read (fd, block, sizeof block) != (int) sizeof block)
+        fail ("read %zu bytes at offset %zu in \"%s\" failed",
+              sizeof block, ofs, file_name);
+      compare_bytes (block, chunk, sizeof block, ofs, file_name);
+    }
+  for (i = 0, ofs = 0; ofs < total; i++, ofs += sizeof block) 
+    {
+      size_t size = total - ofs < sizeof block ? total - ofs : sizeof block;
+      if (read (fd, block, size) != (int) size)
+        fail ("read %zu bytes at offset %zu in \"%s\" failed",
+              size, START + ofs, file_name);
+      memset (chunk, 'a' + i % 26, size);
+      compare_bytes (block, chunk, size, START + ofs, file_name);
+    }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOT']);
+(lg-hole-full) begin
+(lg-hole-full) create "hole"
+(lg-hole-full) open "hole"
+(lg-hole-full) seek "hole" to 65536
+(lg-hole-full) write "hole" until the disk is full
+(lg-hole-full) write "hole" on full disk writes nothing
+(lg-hole-full) size of "hole" matches bytes written
+(lg-hole-full) verify "hole"
+(lg-hole-full) close "hole"
+(lg-hole-full) end
+EOT
+pass;
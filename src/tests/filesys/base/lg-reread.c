@@ -0,0 +1,55 @@
+/* Writes a file several times the size of the buffer cache, then
+   reads it back sequentially over and over, verifying the contents
+   on every pass.  The reads land off a sector boundary in memory,
+   so they are copied through the buffer cache a sector at a time
+   rather than going straight to disk, and almost all the work is
+   cache lookups.  lg-reread.ck checks that every sector read was
+   looked up and reports the lookup rate. */
+
+#include <random.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 102400
+#define BLOCK_SIZE 4096
+#define PASS_CNT 8
+#define SECTOR_SIZE 512
+
+static char buf[FILE_SIZE];
+static char block_buf[BLOCK_SIZE + 1];
+
+void
+test_main (void) 
+{
+  const char *file_name = "reread";
+  /* Start BLOCK off a sector boundary, for the reads to go through
+     the buffer cache. */
+  char *block = block_buf + ((uintptr_t) block_buf % SECTOR_SIZE == 0);
+  size_t ofs;
+  int fd;
+  int pass;
+
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, sizeof buf), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == (int) sizeof buf,
+         "write \"%s\"", file_name);
+
+  for (pass = 0; pass < PASS_CNT; pass++) 
+    {
+      seek (fd, 0);
+      for (ofs = 0; ofs < sizeof buf; ofs += BLOCK_SIZE) 
+        {
+          if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+            fail ("read %d bytes at offset %zu in \"%s\" failed",
+                  BLOCK_SIZE, ofs, file_name);
+          compare_bytes (block, buf + ofs, BLOCK_SIZE, ofs, file_name);
+        }
+      msg ("pass %d: verified contents of \"%s\"", pass, file_name);
+    }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,38 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-reread) begin
+(lg-reread) create "reread"
+(lg-reread) open "reread"
+(lg-reread) write "reread"
+(lg-reread) pass 0: verified contents of "reread"
+(lg-reread) pass 1: verified contents of "reread"
+(lg-reread) pass 2: verified contents of "reread"
+(lg-reread) pass 3: verified contents of "reread"
+(lg-reread) pass 4: verified contents of "reread"
+(lg-reread) pass 5: verified contents of "reread"
+(lg-reread) pass 6: verified contents of "reread"
+(lg-reread) pass 7: verified contents of "reread"
+(lg-reread) close "reread"
+(lg-reread) end
+EOF
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($lookups, $misses) = map (/^Cache: (\d+) lookups, \d+ hits, (\d+) misses/,
+                              @output)
+  or fail "missing \"Cache:\" statistics\n";
+my ($ticks) = map (/^Timer: (\d+) ticks/, @output);
+
+# 8 passes over the 200 sectors of the file.
+my ($read_cnt) = 8 * 200;
+fail "$lookups cache lookups for $read_cnt sectors read: "
+  . "the reads went around the buffer cache\n"
+  if $lookups < $read_cnt;
+
+pass sprintf ("%d cache lookups (%d misses) in %d ticks, "
+              . "%d lookups per second\n",
+              $lookups, $misses, $ticks,
+              $ticks > 0 ? $lookups * 100 / $ticks : 0);
@@ -0,0 +1,62 @@
+/* Writes a 4 MB file in 64 kB chunks, then streams it back twice,
+   verifying every chunk.  The disk does nearly all the work, and when
+   it moves the sectors by DMA the CPU sits idle while it waits.
+   lg-stream.ck reports how many of the IDE commands went by DMA and
+   what share of the run's ticks were idle. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (4 * 1024 * 1024)
+#define CHUNK_SIZE 65536
+#define PASS_CNT 2
+
+static char chunk[CHUNK_SIZE];
+static char expected[CHUNK_SIZE];
+
+/* Fills BUF with the contents expected for the chunk at OFS. */
+static void
+fill_chunk (char *buf, size_t ofs) 
+{
+  random_init (ofs);
+  random_bytes (buf, CHUNK_SIZE);
+}
+
+void
+test_main (void) 
+{
+  const char *file_name = "stream";
+  size_t ofs;
+  int fd;
+  int pass;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) 
+    {
+      fill_chunk (chunk, ofs);
+      if (write (fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write %d bytes at offset %zu in \"%s\" failed",
+              CHUNK_SIZE, ofs, file_name);
+    }
+  msg ("write \"%s\"", file_name);
+
+  for (pass = 0; pass < PASS_CNT; pass++) 
+    {
+      seek (fd, 0);
+      for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE) 
+        {
+          if (read (fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+            fail ("read %d bytes at offset %zu in \"%s\" failed",
+                  CHUNK_SIZE, ofs, file_name);
+          fill_chunk (expected, ofs);
+          compare_bytes (chunk, expected, CHUNK_SIZE, ofs, file_name);
+        }
+      msg ("pass %d: verified contents of \"%s\"", pass, file_name);
+    }
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,35 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-stream) begin
+(lg-stream) create "stream"
+(lg-stream) open "stream"
+(lg-stream) write "stream"
+(lg-stream) pass 0: verified contents of "stream"
+(lg-stream) pass 1: verified contents of "stream"
+(lg-stream) close "stream"
+(lg-stream) end
+EOF
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($idle, $kernel, $user)
+  = map (/^Thread: (\d+) idle ticks, (\d+) kernel ticks, (\d+) user ticks/,
+         @output)
+  or fail "missing \"Thread:\" statistics\n";
+my ($commands, $dma) = (0, 0);
+foreach (@output) {
+    my ($c, $d) = /^ide\d: \d+ requests in (\d+) commands \((\d+) by DMA/
+      or next;
+    $commands += $c;
+    $dma += $d;
+}
+fail "missing IDE statistics\n" if $commands == 0;
+
+my ($ticks) = $idle + $kernel + $user;
+pass sprintf ("%d of %d IDE commands by DMA, "
+              . "%d of %d ticks idle (%d%%)\n",
+              $dma, $commands, $idle, $ticks,
+              $ticks > 0 ? $idle * 100 / $ticks : 0);
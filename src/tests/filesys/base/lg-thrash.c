@@ -0,0 +1,84 @@
+/* Streams a file several times the size of the buffer cache while
+   re-reading a small "hot" file between every block of it, verifying
+   both.  All the reads go through the buffer cache, since they land
+   off a sector boundary in memory.  The large file is read once per
+   pass and the hot file over and over, so the hot file should stay
+   cached while the large file streams past it: lg-thrash.ck fails if
+   the misses add up to much more than one per large-file sector. */
+
+#include <random.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define BIG_SIZE 204800
+#define HOT_SIZE 8192
+#define BLOCK_SIZE 4096
+#define PASS_CNT 4
+#define SECTOR_SIZE 512
+
+static char big[BIG_SIZE];
+static char hot[HOT_SIZE];
+static char block_buf[BLOCK_SIZE + 1];
+
+/* Off a sector boundary, for the reads to go through the buffer
+   cache. */
+static char *block;
+
+static void
+reread_hot (int fd, const char *file_name) 
+{
+  size_t ofs;
+
+  seek (fd, 0);
+  for (ofs = 0; ofs < sizeof hot; ofs += BLOCK_SIZE) 
+    {
+      if (read (fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+        fail ("read %d bytes at offset %zu in \"%s\" failed",
+              BLOCK_SIZE, ofs, file_name);
+      compare_bytes (block, hot + ofs, BLOCK_SIZE, ofs, file_name);
+    }
+}
+
+void
+test_main (void) 
+{
+  const char *big_name = "big";
+  const char *hot_name = "hot";
+  size_t ofs;
+  int big_fd, hot_fd;
+  int pass;
+
+  block = block_buf + ((uintptr_t) block_buf % SECTOR_SIZE == 0);
+  random_bytes (big, sizeof big);
+  random_bytes (hot, sizeof hot);
+  CHECK (create (big_name, sizeof big), "create \"%s\"", big_name);
+  CHECK (create (hot_name, sizeof hot), "create \"%s\"", hot_name);
+  CHECK ((big_fd = open (big_name)) > 1, "open \"%s\"", big_name);
+  CHECK ((hot_fd = open (hot_name)) > 1, "open \"%s\"", hot_name);
+  CHECK (write (big_fd, big, sizeof big) == (int) sizeof big,
+         "write \"%s\"", big_name);
+  CHECK (write (hot_fd, hot, sizeof hot) == (int) sizeof hot,
+         "write \"%s\"", hot_name);
+
+  for (pass = 0; pass < PASS_CNT; pass++) 
+    {
+      seek (big_fd, 0);
+      for (ofs = 0; ofs < sizeof big; ofs += BLOCK_SIZE) 
+        {
+          if (read (big_fd, block, BLOCK_SIZE) != BLOCK_SIZE)
+            fail ("read %d bytes at offset %zu in \"%s\" failed",
+                  BLOCK_SIZE, ofs, big_name);
+          compare_bytes (block, big + ofs, BLOCK_SIZE, ofs, big_name);
+          reread_hot (hot_fd, hot_name);
+        }
+      msg ("pass %d: verified contents of \"%s\" and \"%s\"",
+           pass, big_name, hot_name);
+    }
+
+  msg ("close \"%s\"", big_name);
+  close (big_fd);
+  msg ("close \"%s\"", hot_name);
+  close (hot_fd);
+}
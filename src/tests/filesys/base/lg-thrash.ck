@@ -0,0 +1,40 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-thrash) begin
+(lg-thrash) create "big"
+(lg-thrash) create "hot"
+(lg-thrash) open "big"
+(lg-thrash) open "hot"
+(lg-thrash) write "big"
+(lg-thrash) write "hot"
+(lg-thrash) pass 0: verified contents of "big" and "hot"
+(lg-thrash) pass 1: verified contents of "big" and "hot"
+(lg-thrash) pass 2: verified contents of "big" and "hot"
+(lg-thrash) pass 3: verified contents of "big" and "hot"
+(lg-thrash) close "big"
+(lg-thrash) close "hot"
+(lg-thrash) end
+EOF
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($lookups, $misses, $ahead)
+  = map (/^Cache: (\d+) lookups, \d+ hits, (\d+) misses, (\d+) read ahead/,
+         @output)
+  or fail "missing \"Cache:\" statistics\n";
+
+# Each of the 4 passes reads the 400 sectors of "big" once and the
+# 16 sectors of "hot" once after each of its 50 blocks.  Allow one
+# load per "big" sector and an eighth of the "hot" reads besides, for
+# loading the program and the file system's own sectors.
+my ($big_reads, $hot_reads) = (4 * 400, 4 * 50 * 16);
+my ($loads) = $misses + $ahead;
+fail "$loads sectors loaded into the cache for $big_reads reads of "
+  . "\"big\" and $hot_reads of \"hot\": \"hot\" did not stay cached\n"
+  if $loads > $big_reads + $hot_reads / 8;
+
+pass "$loads sectors loaded into the cache for $big_reads reads of "
+  . "\"big\" and $hot_reads of \"hot\" ($lookups lookups)\n";
@@ -0,0 +1,46 @@
+/* Child process of page-read-par.
+   Fills 1 MB of memory, so that most of it has to go to swap,
+   then read()s the file "data" over all of it, checking that
+   what arrives is what the parent wrote.  Does so twice. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+
+const char *test_name = "child-read";
+
+#define SIZE (1024 * 1024)
+#define DATA_SIZE (64 * 1024)
+#define ROUNDS 2
+static char buf[SIZE];
+
+int
+main (void)
+{
+  size_t ofs, i;
+  int round, fd;
+
+  fd = open ("data");
+  if (fd < 2)
+    fail ("open \"data\"");
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      /* Dirty every page, so that the reads below land in pages
+         that are being swapped out or have to be swapped in. */
+      memset (buf, round + 1, SIZE);
+
+      for (ofs = 0; ofs < SIZE; ofs += DATA_SIZE)
+        {
+          seek (fd, 0);
+          if (read (fd, buf + ofs, DATA_SIZE) != DATA_SIZE)
+            fail ("read \"data\" into buf[%zu]", ofs);
+        }
+
+      for (i = 0; i < SIZE; i++)
+        if (buf[i] != (char) (i % DATA_SIZE % 251))
+          fail ("round %d: byte %zu is %d", round, i, buf[i]);
+    }
+
+  return 0x42;
+}
@@ -0,0 +1,83 @@
+/* Keeps a 512 kB working set in use while streaming, over and
+   over, through a 1 MB mapping of a file, which together do not
+   fit in memory.  Touches the whole working set between every
+   few pages of the scan, and verifies both.  Pages of the
+   mapping are read once per pass, so they should be the ones
+   evicted rather than the working set.  The mapping's pages are
+   clean and never go to swap, so page-mm-scan.ck fails if more
+   than one working set's worth of pages was written there. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HOT_SIZE (512 * 1024)
+#define FILE_SIZE (1024 * 1024)
+#define CHUNK_SIZE (16 * 1024)
+#define CHUNK_CNT (FILE_SIZE / CHUNK_SIZE)
+#define PAGE_SIZE 4096
+#define PASS_CNT 3
+
+static char hot[HOT_SIZE];
+static char chunk[CHUNK_SIZE];
+
+/* Returns the byte at offset ofs of "scan". */
+static char
+file_byte (size_t ofs)
+{
+  return ofs % 253;
+}
+
+void
+test_main (void)
+{
+  char *map_base = (char *) 0x10000000;
+  size_t ofs, i;
+  mapid_t map;
+  int pass;
+  int fd;
+
+  CHECK (create ("scan", 0), "create \"scan\"");
+  CHECK ((fd = open ("scan")) > 1, "open \"scan\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      for (i = 0; i < CHUNK_SIZE; i++)
+        chunk[i] = file_byte (ofs + i);
+      if (write (fd, chunk, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write \"scan\" at offset %zu", ofs);
+    }
+  msg ("write \"scan\"");
+  CHECK ((map = mmap (fd, map_base)) != MAP_FAILED, "mmap \"scan\"");
+
+  memset (hot, 0x5a, sizeof hot);
+  for (pass = 0; pass < PASS_CNT; pass++)
+    {
+      for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+        {
+          /* Read a few pages of the mapping... */
+          for (i = 0; i < CHUNK_SIZE; i += PAGE_SIZE)
+            if (map_base[ofs + i] != file_byte (ofs + i))
+              fail ("pass %d: byte %zu of \"scan\" is %d",
+                    pass, ofs + i, map_base[ofs + i]);
+
+          /* ...then the whole working set. */
+          for (i = 0; i < HOT_SIZE; i += PAGE_SIZE)
+            {
+              if (hot[i] != 0x5a)
+                fail ("pass %d: byte %zu of working set is %d",
+                      pass, i, hot[i]);
+              hot[i + PAGE_SIZE - 1]++;
+            }
+        }
+
+      for (i = 0; i < HOT_SIZE; i += PAGE_SIZE)
+        if (hot[i + PAGE_SIZE - 1] != (char) (0x5a + (pass + 1) * CHUNK_CNT))
+          fail ("pass %d: working set page %zu lost a write",
+                pass, i / PAGE_SIZE);
+      msg ("pass %d: verified \"scan\" and working set", pass);
+    }
+
+  munmap (map);
+  close (fd);
+}
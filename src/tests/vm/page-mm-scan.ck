@@ -0,0 +1,32 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-mm-scan) begin
+(page-mm-scan) create "scan"
+(page-mm-scan) open "scan"
+(page-mm-scan) write "scan"
+(page-mm-scan) mmap "scan"
+(page-mm-scan) pass 0: verified "scan" and working set
+(page-mm-scan) pass 1: verified "scan" and working set
+(page-mm-scan) pass 2: verified "scan" and working set
+(page-mm-scan) end
+EOF
+
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($swap_in, $swap_out) = map (/\(swap\): (\d+) reads, (\d+) writes/, @output)
+  or fail "missing swap device statistics\n";
+
+# The mapping's pages are clean and are dropped rather than swapped,
+# so all but a few of the sectors written to swap belong to the 128
+# pages (1,024 sectors) of the working set.  Evicting it once over is
+# allowed; evicting it on every pass is not.
+my ($hot_sectors) = 1024;
+fail "$swap_out sectors of the working set written to swap, more than "
+  . "its $hot_sectors: it was evicted in favour of the scan\n"
+  if $swap_out > $hot_sectors;
+
+pass "$swap_out sectors written to swap and $swap_in read back "
+  . "for a $hot_sectors-sector working set\n";
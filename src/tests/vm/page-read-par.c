@@ -0,0 +1,34 @@
+/* Runs 4 child-read processes at once, each read()ing a file
+   over and over into a buffer that, together with the others',
+   is too big to stay in memory. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+#define DATA_SIZE (64 * 1024)
+
+static char data[DATA_SIZE];
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  size_t i;
+  int fd;
+
+  for (i = 0; i < DATA_SIZE; i++)
+    data[i] = i % 251;
+  CHECK (create ("data", 0), "create \"data\"");
+  CHECK ((fd = open ("data")) > 1, "open \"data\"");
+  CHECK (write (fd, data, DATA_SIZE) == DATA_SIZE, "write \"data\"");
+  close (fd);
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK ((children[i] = exec ("child-read")) != -1,
+           "exec \"child-read\"");
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %zu", i);
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-read-par) begin
+(page-read-par) create "data"
+(page-read-par) open "data"
+(page-read-par) write "data"
+(page-read-par) exec "child-read"
+(page-read-par) exec "child-read"
+(page-read-par) exec "child-read"
+(page-read-par) exec "child-read"
+(page-read-par) wait for child 0
+(page-read-par) wait for child 1
+(page-read-par) wait for child 2
+(page-read-par) wait for child 3
+(page-read-par) end
+EOF
+pass;
@@ -64,6 +64,9 @@ static const char *scratch_bdev_name;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
+
+/* -cache: Number of sectors to hold in the buffer cache. */
+static size_t cache_block_cnt = CACHE_DEFAULT_BLOCKS;
 #endif /* FILESYS */
 
 /*! -ul: Maximum number of pages to put into palloc's user pool. */
@@ -76,6 +79,9 @@ static char **read_command_line(void);
 static char **parse_options(char **argv);
 static void run_actions(char **argv);
 static void usage(void);
+#ifdef FILESYS
+static size_t parse_cache_blocks(const char *value);
+#endif
 
 #ifdef FILESYS
 static void locate_block_devices(void);
@@ -135,7 +141,7 @@ int main(void) {
     /* Initialize file system. */
     ide_init();
     locate_block_devices();
-    cache_init();
+    cache_init(cache_block_cnt);
     filesys_init(format_filesys);
     process_current()->working_dir = dir_open_root();
 #endif
@@ -251,10 +257,18 @@ static char ** parse_options(char **argv) {
 #ifdef FILESYS
         else if (!strcmp(name, "-f"))
             format_filesys = true;
+        else if (!strcmp(name, "-extents"))
+            filesys_format_extents = true;
         else if (!strcmp(name, "-filesys"))
             filesys_bdev_name = value;
         else if (!strcmp(name, "-scratch"))
             scratch_bdev_name = value;
+        else if (!strcmp(name, "-cache"))
+            cache_block_cnt = parse_cache_blocks(value);
+        else if (!strcmp(name, "-cache-flush"))
+            cache_flush_ms = atoi(value);
+        else if (!strcmp(name, "-cache-dirty"))
+            cache_dirty_pct = atoi(value);
 #ifdef VM
         else if (!strcmp(name, "-swap"))
             swap_bdev_name = value;
@@ -347,6 +361,27 @@ static void run_actions(char **argv) {
     }
 }
 
+#ifdef FILESYS
+/*! Parses VALUE, the COUNT of -cache=COUNT, which must be a whole number
+    from CACHE_MIN_BLOCKS up to what a quarter of RAM holds, so that the
+    rest of the kernel pool is left for everything else.  Prints help and
+    powers off if it is not. */
+static size_t parse_cache_blocks(const char *value) {
+    size_t max = init_ram_pages / 4 * (PGSIZE / BLOCK_SECTOR_SIZE);
+    size_t cnt = 0;
+    const char *p = value != NULL ? value : "";
+
+    for (; *p >= '0' && *p <= '9' && cnt <= max; p++)
+        cnt = cnt * 10 + (*p - '0');
+    if (p == value || *p != '\0' || cnt < CACHE_MIN_BLOCKS || cnt > max) {
+        printf("-cache=%s: COUNT must be from %d to %zu\n",
+               value != NULL ? value : "", CACHE_MIN_BLOCKS, max);
+        usage();
+    }
+    return cnt;
+}
+#endif
+
 /* Prints a kernel command line help message and powers off the
    machine. */
 static void usage(void) {
@@ -373,8 +408,13 @@ static void usage(void) {
            "  -r                 Reboot after actions.\n"
 #ifdef FILESYS
            "  -f                 Format file system device during startup.\n"
+           "  -extents           Format with extent-based inodes.\n"
            "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
            "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+           "  -cache=COUNT       Hold COUNT sectors in the buffer cache, up to\n"
+           "                     a quarter of RAM.\n"
+           "  -cache-flush=MS    Write back dirty cache blocks every MS ms.\n"
+           "  -cache-dirty=PCT   Flush early once PCT%% of the cache is dirty.\n"
 #ifdef VM
            "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
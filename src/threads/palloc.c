@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -30,6 +31,7 @@ struct pool {
     struct lock lock;                   /*!< Mutual exclusion. */
     struct bitmap *used_map;            /*!< Bitmap of free pages. */
     uint8_t *base;                      /*!< Base of pool. */
+    size_t free_cnt;                    /*!< Number of free pages. */
 };
 
 /*! Two pools: one for kernel data, one for user pages. */
@@ -74,6 +76,11 @@ void * palloc_get_multiple(enum palloc_flags flags, size_t page_cnt) {
 
     lock_acquire(&pool->lock);
     page_idx = bitmap_scan_and_flip(pool->used_map, 0, page_cnt, false);
+    if (page_idx != BITMAP_ERROR) {
+        enum intr_level old_level = intr_disable();
+        pool->free_cnt -= page_cnt;
+        intr_set_level(old_level);
+    }
     lock_release(&pool->lock);
 
     if (page_idx != BITMAP_ERROR)
@@ -108,6 +115,7 @@ void * palloc_get_page(enum palloc_flags flags) {
 void palloc_free_multiple(void *pages, size_t page_cnt) {
     struct pool *pool;
     size_t page_idx;
+    enum intr_level old_level;
 
     ASSERT(pg_ofs(pages) == 0);
     if (pages == NULL || page_cnt == 0)
@@ -128,6 +136,12 @@ void palloc_free_multiple(void *pages, size_t page_cnt) {
 
     ASSERT(bitmap_all(pool->used_map, page_idx, page_cnt));
     bitmap_set_multiple(pool->used_map, page_idx, page_cnt, false);
+
+    /* Dying threads' pages are freed while scheduling, where the pool lock
+       cannot be taken, so the count is kept with interrupts off instead. */
+    old_level = intr_disable();
+    pool->free_cnt += page_cnt;
+    intr_set_level(old_level);
 }
 
 /*! Frees the page at PAGE. */
@@ -135,6 +149,21 @@ void palloc_free_page(void *page) {
     palloc_free_multiple(page, 1);
 }
 
+/*! Returns the number of free pages in the user pool if PAL_USER is set in
+    FLAGS, otherwise in the kernel pool.  The count may be stale by the time
+    the caller looks at it. */
+size_t palloc_free_cnt(enum palloc_flags flags) {
+    struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+    return pool->free_cnt;
+}
+
+/*! Returns the number of pages in the user pool if PAL_USER is set in
+    FLAGS, otherwise in the kernel pool. */
+size_t palloc_page_cnt(enum palloc_flags flags) {
+    struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+    return bitmap_size(pool->used_map);
+}
+
 /*! Initializes pool P as starting at START and ending at END,
     naming it NAME for debugging purposes. */
 static void init_pool(struct pool *p, void *base, size_t page_cnt,
@@ -153,6 +182,7 @@ static void init_pool(struct pool *p, void *base, size_t page_cnt,
     lock_init(&p->lock);
     p->used_map = bitmap_create_in_buf(page_cnt, base, bm_pages * PGSIZE);
     p->base = base + bm_pages * PGSIZE;
+    p->free_cnt = page_cnt;
 }
 
 /*! Returns true if PAGE was allocated from POOL, false otherwise. */
@@ -135,6 +135,11 @@ struct thread {
     /**@{*/
 #endif
 
+#ifdef FILESYS
+    /*! Owned by filesys/journal.c. */
+    int journal_depth;                  /*!< Nesting of open operations. */
+#endif
+
     /** Needed for stack growth through a system call. */
     void* esp;                          /*!< Thread's stack pointer. */
     bool in_sc;                      /* Whether the thread is in a system call. */
@@ -181,7 +181,7 @@ static void page_fault(struct intr_frame *f) {
  * Grows the stack into the given user page. Returns the page table entry.
  */
 struct supp_page *grow_stack(void* upage) {
-    struct frame *new_fr = frame_create(PAL_USER | PAL_ZERO, false);
+    struct frame *new_fr = frame_create(PAL_USER | PAL_ZERO, false, false);
     new_fr->page = create_swapslot_page(
         &process_current()->supp_page_table, upage, 
         thread_current()->pagedir, new_fr, true);
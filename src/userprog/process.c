@@ -731,7 +731,7 @@ static bool setup_stack(void **esp) {
     
     void *upage = (void *)(PHYS_BASE - PGSIZE);
     
-    new_fr = frame_create(PAL_USER | PAL_ZERO, false);
+    new_fr = frame_create(PAL_USER | PAL_ZERO, false, false);
     new_fr->page = create_swapslot_page(
             &process_current()->supp_page_table, upage, 
             thread_current()->pagedir, new_fr, true);
@@ -37,6 +37,14 @@ int getArg(int argnum, struct intr_frame *f);
 
 static bool r_valid(uint8_t *uaddr);
 static bool w_valid(uint8_t *uaddr);
+
+/* Number of user pages read() and write() pin at a time. */
+#define PIN_PAGES 16
+
+static int file_rw(struct file *file, uint8_t *buffer, unsigned length,
+                   bool write);
+static off_t file_transfer(struct file *file, uint8_t *buffer, off_t size,
+                           bool write);
 static struct lock filesys_lock;
 
 static struct lock filesys_lock;
@@ -219,42 +227,11 @@ int filesize(int fd){
 int read(int fd, void *buffer, unsigned length){
     int index;
     int bytes_read = EXIT_FAILURE;
-    int chunk_read;
-    off_t to_read;
-    off_t page;
-    struct hash *supp_table;
     if (fd >= 0 && fd < MAX_FILES) {
         index = process_current()->files[fd];
         if (index != -1 && open_files[index] &&
             !file_is_dir(open_files[index])) {
-
-            bytes_read = 0;
-            chunk_read = 1;
-            page = 0;
-            supp_table = &process_current()->supp_page_table;
-            if(pg_ofs(buffer)){
-                to_read = PGSIZE - (off_t)pg_ofs(buffer);
-                to_read = (off_t)length < to_read? (off_t)length : to_read;
-            }
-            else{
-                to_read = (off_t)length / PGSIZE ? 
-                            PGSIZE : (off_t)(length % PGSIZE);
-            }
-            while (length > 0 && chunk_read > 0){
-                if (!w_valid((uint8_t*)buffer)){
-                    thread_exit(EXIT_FAILURE);
-                    return EXIT_FAILURE;
-                }
-                pin_page(supp_table, (void*)buffer);
-                bytes_read += (chunk_read = file_read(open_files[index],
-                    buffer, to_read));
-                unpin_page(supp_table, (void*)buffer);
-                length -= to_read;
-                page ++;
-                buffer = (void*)((off_t) buffer + to_read);
-                to_read = (off_t)length / PGSIZE ?
-                            PGSIZE : (off_t)(length % PGSIZE);
-            }
+            bytes_read = file_rw(open_files[index], buffer, length, false);
         }
     }
     return bytes_read;
@@ -263,10 +240,6 @@ int read(int fd, void *buffer, unsigned length){
 int write(int fd, const void *buffer, unsigned length){
     int index;
     int bytes_written = EXIT_FAILURE;
-    int chunk_written;
-    off_t to_write;
-    off_t page;
-    struct hash *supp_table;
     if (fd == 1){
         void *addr;
         for (addr = (void*)buffer; addr < (void*)((off_t)buffer + length);
@@ -283,38 +256,91 @@ int write(int fd, const void *buffer, unsigned length){
         index = process_current()->files[fd];
         if (index != -1 && open_files[index] &&
             !file_is_dir(open_files[index])) {
-            bytes_written = 0;
-            chunk_written = 1;
-            page = 0;
-            supp_table = &process_current()->supp_page_table;
-            if(pg_ofs(buffer)){
-                to_write = PGSIZE - (off_t)pg_ofs(buffer);
-                to_write = (off_t)length < to_write? (off_t)length : to_write;
-            }
-            else{
-                to_write = (off_t)length / PGSIZE ? 
-                            PGSIZE : (off_t)(length % PGSIZE);
-            }
-            while (length > 0 && chunk_written > 0){
-                if (!r_valid((uint8_t*)buffer)){
-                    thread_exit(EXIT_FAILURE);
-                    return EXIT_FAILURE;
-                }
-                pin_page(supp_table, (void*)buffer);
-                bytes_written += (chunk_written = file_write(open_files[index],
-                    buffer, to_write));
-                unpin_page(supp_table, (void*)buffer);
-                length -= to_write;
-                page ++;
-                buffer = (void*)((off_t) buffer + to_write);
-                to_write = (off_t)length / PGSIZE ?
-                            PGSIZE : (off_t)(length % PGSIZE);
-            }
+            bytes_written = file_rw(open_files[index], (void*)buffer, length,
+                                    true);
         }
     }
     return bytes_written;
 }
 
+/* Moves LENGTH bytes between FILE and the user buffer at BUFFER, writing to
+   FILE if WRITE and reading from it otherwise.  The buffer is checked and
+   pinned PIN_PAGES pages at a time, each batch once, so that the whole batch
+   can be handed to file_transfer().  Kills the process if the buffer is not
+   valid.  Returns the number of bytes moved. */
+static int file_rw(struct file *file, uint8_t *buffer, unsigned length,
+                   bool write){
+    struct hash *supp_table = &process_current()->supp_page_table;
+    int bytes_moved = 0;
+    uint8_t *page, *end;
+    off_t chunk, moved;
+
+    while (length > 0){
+        end = (uint8_t*)pg_round_down(buffer) + PIN_PAGES * PGSIZE;
+        chunk = (unsigned)(end - buffer) < length ?
+                    (off_t)(end - buffer) : (off_t)length;
+        for (page = pg_round_down(buffer); page < buffer + chunk;
+            page += PGSIZE){
+            uint8_t *addr = page < buffer ? buffer : page;
+            if (!(write ? r_valid(addr) : w_valid(addr))){
+                thread_exit(EXIT_FAILURE);
+                return EXIT_FAILURE;
+            }
+        }
+        pin_pages(supp_table, buffer, chunk);
+        moved = file_transfer(file, buffer, chunk, write);
+        unpin_pages(supp_table, buffer, chunk);
+        bytes_moved += moved;
+        if (moved < chunk)
+            break;
+        length -= chunk;
+        buffer += chunk;
+    }
+    return bytes_moved;
+}
+
+/* Moves SIZE bytes between FILE and the pinned user buffer at BUFFER.  If
+   the buffer lines up with the file's sectors, the whole sectors go straight
+   between the disk and the buffer's frames, and only the partial sectors at
+   either end go through the buffer cache. */
+static off_t file_transfer(struct file *file, uint8_t *buffer, off_t size,
+                           bool write){
+    struct hash *supp_table = &process_current()->supp_page_table;
+    void *sectors[PIN_PAGES * PGSIZE / BLOCK_SECTOR_SIZE];
+    off_t done = 0, head, moved;
+    size_t cnt, i;
+
+    if ((uintptr_t)buffer % BLOCK_SECTOR_SIZE ==
+        (uintptr_t)file_tell(file) % BLOCK_SECTOR_SIZE){
+        /* Up to the first sector boundary through the cache. */
+        head = (BLOCK_SECTOR_SIZE - file_tell(file) % BLOCK_SECTOR_SIZE)
+                    % BLOCK_SECTOR_SIZE;
+        head = head < size ? head : size;
+        done = write ? file_write(file, buffer, head)
+                     : file_read(file, buffer, head);
+        if (done < head)
+            return done;
+
+        while ((cnt = (size - done) / BLOCK_SECTOR_SIZE) > 0){
+            for (i = 0; i < cnt; i++)
+                sectors[i] = pinned_kaddr(supp_table,
+                    buffer + done + i * BLOCK_SECTOR_SIZE, !write);
+            moved = write ?
+                file_write_sectors(file, (const void *const *)sectors, cnt) :
+                file_read_sectors(file, sectors, cnt);
+            done += moved;
+            if (moved < (off_t)cnt * BLOCK_SECTOR_SIZE)
+                break;
+        }
+    }
+
+    /* Whatever is left through the cache. */
+    if (done < size)
+        done += write ? file_write(file, buffer + done, size - done)
+                      : file_read(file, buffer + done, size - done);
+    return done;
+}
+
 void seek(int fd, unsigned position){
     int index;
     if (fd >= 0 && fd < MAX_FILES &&
@@ -447,9 +473,7 @@ void munmap(mapid_t mapping){
                 ASSERT(is_user_vaddr((void*)i));
                 struct supp_page *p = get_supp_page(supp_table, (void*)i);
 
-                if (p->fr) {
-                    frame_evict(p->fr);
-                }
+                frame_evict_page(p);
                 free_supp_page(supp_table, p);
             }
             file_close(mm.file);         
@@ -29,59 +29,141 @@
 #include "page.h"
 #include "swap.h"
 
-static struct list frame_table;	/* Frames in the table */
- // The frame table is accessed by multiple processes simultaneously. 
-// Stay safe with a lock.
+/* Frames in the table are kept on one of two pairs of lists, one for
+ * anonymous (stack, heap and swap) pages and one for file pages, those of
+ * mmapped files and executable code.  A page comes in on its inactive list,
+ * and moves to the active list once it is found accessed there: an anonymous
+ * page the first time, a file page the second, so that a single sequential
+ * pass through a mapping never gets in.  Victims come from the front of the
+ * inactive lists, which are refilled from the active lists whenever they
+ * grow shorter, with active pages that have not been accessed since last
+ * looked at. */
+struct frame_lru {
+    struct list active;	/* Frames accessed again since coming in. */
+    struct list inactive;	/* Frames on probation, evicted from the front. */
+    size_t active_cnt, inactive_cnt;	/* Lengths of the lists. */
+};
+
+static struct frame_lru anon_lru, file_lru;	/* Frames in the table */
+static struct list frame_spares;	/* Frame structs holding no page, for reuse */
+// The frame table is accessed by multiple processes simultaneously.  
+// frame_lock protects all the lists and the links between frames and their
+// pages (fr->page and spg->fr), and is never held across I/O.  Each frame's
+// own lock protects its pinned count and evicting flag, and is taken after
+// frame_lock when both are held.  Frame structs are recycled rather than
+// freed, so a stale spg->fr still points at a frame, just not the page's.
 static struct lock frame_lock;
-struct frame *frame_choose_victim(void); /* Chooses the next frame to free. */
+
+/* Free user frames below which frame_create() wakes the page-out daemon,
+ * and up to which the daemon then frees frames ahead of demand, a batch of
+ * up to PAGEOUT_BATCH at a time.  Both are capped to a fraction of the user
+ * pool in init_frame_table() so that small pools stay mostly in use. */
+#define PAGEOUT_LOW 16
+#define PAGEOUT_HIGH 32
+#define PAGEOUT_BATCH SWAP_CLUSTER
+
+static size_t pageout_low, pageout_high;
+static struct semaphore pageout_sema;	/* Upped to wake the daemon. */
+static bool pageout_pending;	/* Set while the daemon is awake or woken,
+                                   protected by frame_lock. */
+
+/* Frames evicted by faulting threads and by the page-out daemon, and pages
+ * moved to an active list, protected by frame_lock. */
+static long long evict_sync_cnt, evict_async_cnt, activate_cnt;
+
+static void frame_lru_init(struct frame_lru *lru);
+static struct frame_lru *frame_lru_of(struct frame *fr);
+static void frame_lru_move(struct frame *fr, bool active);
+static struct supp_page *frame_evictable(struct frame *fr);
+static void frame_age_active(struct frame_lru *lru);
+static struct frame *frame_scan_inactive(struct frame_lru *lru);
+static struct frame *frame_scan_lru(struct frame_lru *lru);
+static struct frame *frame_scan_victim(void);
+static struct frame *frame_claim(struct supp_page *spg);
+static void frame_evict_batch(struct frame *victims[], size_t cnt);
+static void frame_release(struct frame *fr);
+static size_t frame_page_out(size_t cnt, long long *evict_cnt);
+static void pageout_daemon(void *aux);
 
 
 /*! init_frame_table
  * 
- *  @description Initializes the frame table.
+ *  @description Initializes the frame table and starts the page-out daemon.
  * 
  */
 void init_frame_table(void) {
-	/* Initialize the frame table list. */
-	list_init(&frame_table);
+	/* Initialize the frame table lists. */
+	frame_lru_init(&anon_lru);
+	frame_lru_init(&file_lru);
+	list_init(&frame_spares);
     lock_init(&frame_lock);
+
+    size_t user_pages = palloc_page_cnt(PAL_USER);
+    pageout_low = user_pages / 8 < PAGEOUT_LOW ? user_pages / 8 : PAGEOUT_LOW;
+    pageout_high = user_pages / 4 < PAGEOUT_HIGH ?
+        user_pages / 4 : PAGEOUT_HIGH;
+    sema_init(&pageout_sema, 0);
+    pageout_pending = false;
+    thread_create("pageout", PRI_DEFAULT, pageout_daemon, NULL);
 }
 
 /*! frame_create
  *  
  *  @description This gets a new page from the user pool and adds it to the
- *  frame table.  If there are no available pages, this evicts one and 
- *  tries again.
+ *  frame table.  If there are no available pages, because the page-out
+ *  daemon has fallen behind, this evicts one and tries again.  Wakes the
+ *  daemon once free pages run low.
+ *
+ *  The new frame goes on the inactive list for file pages if file, or the
+ *  one for anonymous pages otherwise.  It is not evicted before its page is
+ *  mapped, so the caller links the two (fr->page and spg->fr) without
+ *  frame_lock.
  *  
  *  @return a pointer to the new page
  */
-struct frame *frame_create(int flags, bool pinned) {
-
-	lock_acquire(&frame_lock);
+struct frame *frame_create(int flags, bool pinned, bool file) {
+    void *kpage;
 
-    /* Get a page from the user pool. */	
-    void *kpage = palloc_get_page(flags);
-	
-	/* If couldn't get page, evict and try again. */
-	if (!kpage) {
-		frame_evict(frame_choose_victim());
-		kpage = palloc_get_page(flags);
-	}
-
-    if (!kpage) {
-        PANIC("Page eviction failed.");
+    /* Get a page from the user pool, evicting one if there is none. */
+    while ((kpage = palloc_get_page(flags)) == NULL) {
+        /* Wait for pinned and busy frames to come free. */
+        if (frame_page_out(1, &evict_sync_cnt) == 0)
+            thread_yield();
     }
 
+	lock_acquire(&frame_lock);
+
 	/* Create and update the frame struct so we can add it to our table. */
-	struct frame *new_frame = (struct frame *)calloc(1, sizeof(struct frame));
+	struct frame *new_frame;
+	if (!list_empty(&frame_spares)) {
+	    new_frame = list_entry(list_pop_front(&frame_spares), struct frame,
+	                           frame_elem);
+	} else {
+	    new_frame = (struct frame *)calloc(1, sizeof(struct frame));
+	    if (!new_frame)
+	        PANIC("Out of memory for frame table.");
+	    lock_init(&new_frame->lock);
+	    cond_init(&new_frame->evicted);
+	}
 	new_frame->phys_addr = kpage;
     new_frame->page = NULL;
     new_frame->evicting = false;
     new_frame->pinned = (int)pinned;
+    new_frame->file = file;
+    new_frame->active = false;
+    new_frame->referenced = false;
     pagedir_set_dirty(thread_current()->pagedir, kpage, false);
 	
-	/* Add the ne page to the frame table. */
-	list_push_back(&frame_table, &new_frame->frame_elem);
+	/* Add the new page to the frame table, on probation. */
+	struct frame_lru *lru = frame_lru_of(new_frame);
+	list_push_back(&lru->inactive, &new_frame->frame_elem);
+	lru->inactive_cnt++;
+
+    /* Get the daemon freeing frames before the next fault has to. */
+    if (!pageout_pending && palloc_free_cnt(PAL_USER) < pageout_low) {
+        pageout_pending = true;
+        sema_up(&pageout_sema);
+    }
 
     lock_release(&frame_lock);
 	
@@ -91,7 +173,8 @@ struct frame *frame_create(int flags, bool pinned) {
 /*! frame_free
  * 
  *  @description This frees a frame and removes it from the frame list.
- *  Then it frees the page inside of it.
+ *  Then it frees the page inside of it.  Only for frames that cannot be
+ *  evicted meanwhile, such as one whose page was never mapped.
  * 
  *  @param fr - the frame to be freed
  *
@@ -100,93 +183,440 @@ struct frame *frame_create(int flags, bool pinned) {
 int frame_free(struct frame *fr) {
     if (!fr) return 1;
 
-    bool unlock = false;
-    if (!lock_held_by_current_thread(&frame_lock)) {
-        unlock = true;
-        lock_acquire(&frame_lock);
-    }
+    if (fr->page)
+        pagedir_clear_page(fr->page->pd, fr->page->vaddr);
+    frame_release(fr);
 
-	/* Remove the frame from the frame table. */
-	list_remove(&fr->frame_elem);
-    
-    pagedir_clear_page(fr->page->pd, fr->page->vaddr);
-	
+	/* Return 0 if successful, 1 otherwise. */
+	return 0;
+}
+
+/*! frame_release
+ * 
+ *  @description Frees fr's page and moves fr from the frame table to the
+ *  spares, unlinking it from its page and waking anyone waiting for it to be
+ *  evicted.
+ */
+static void frame_release(struct frame *fr) {
 	/* Remove the page so there is space. */
 	palloc_free_page(fr->phys_addr);
 
-	free((void*)fr);
+    lock_acquire(&frame_lock);
+    lock_acquire(&fr->lock);
+    if (fr->page)
+        fr->page->fr = NULL;
+    fr->page = NULL;
+    fr->evicting = false;
+    fr->pinned = 0;
+    cond_broadcast(&fr->evicted, &fr->lock);
+    lock_release(&fr->lock);
 
-    if (unlock) lock_release(&frame_lock);
+	/* Remove the frame from the frame table. */
+	if (fr->active)
+	    frame_lru_of(fr)->active_cnt--;
+	else
+	    frame_lru_of(fr)->inactive_cnt--;
+	list_remove(&fr->frame_elem);
+	list_push_back(&frame_spares, &fr->frame_elem);
+    lock_release(&frame_lock);
+}
 
-	/* Return 0 if successful, 1 otherwise. */
-	return 0;
+/*! frame_lock_page
+ * 
+ *  @description Finds the frame holding spg's page and locks it, first
+ *  waiting for any eviction of the page in progress to finish.  The caller
+ *  releases fr->lock when done.
+ * 
+ *  @return the frame holding the page, or NULL if it is not in one.
+ */
+struct frame *frame_lock_page(struct supp_page *spg) {
+    struct frame *fr;
+
+    lock_acquire(&frame_lock);
+    fr = spg->fr;
+    if (fr == NULL) {
+        lock_release(&frame_lock);
+        return NULL;
+    }
+    lock_acquire(&fr->lock);
+    lock_release(&frame_lock);
+
+    /* The evictor unlinks the page before signalling, and the frame may be
+     * reused for another page before we wake up. */
+    while (fr->evicting && fr->page == spg)
+        cond_wait(&fr->evicted, &fr->lock);
+    if (fr->page != spg) {
+        lock_release(&fr->lock);
+        return NULL;
+    }
+    return fr;
+}
+
+/*! frame_pin
+ * 
+ *  @description Pins the frame holding spg's page so that it is not
+ *  evicted, after waiting out any eviction of it in progress.
+ * 
+ *  @return true if the page was in a frame, false if it has to be loaded.
+ */
+bool frame_pin(struct supp_page *spg) {
+    struct frame *fr = frame_lock_page(spg);
+    if (fr == NULL)
+        return false;
+    ASSERT(fr->pinned >= 0);
+    fr->pinned++;
+    lock_release(&fr->lock);
+    return true;
+}
+
+/*! frame_unpin
+ * 
+ *  @description Undoes one frame_pin() of fr.
+ */
+void frame_unpin(struct frame *fr) {
+    lock_acquire(&fr->lock);
+    ASSERT(fr->pinned > 0);
+    ASSERT(!fr->evicting);
+    fr->pinned--;
+    lock_release(&fr->lock);
+}
+
+/*! frame_claim
+ * 
+ *  @description Marks the frame holding spg's page evicting on behalf of the
+ *  page's owner, which is about to get rid of the page, after waiting out any
+ *  eviction of it in progress.
+ * 
+ *  @return the frame, or NULL if the page is not in one.
+ */
+static struct frame *frame_claim(struct supp_page *spg) {
+    struct frame *fr = frame_lock_page(spg);
+    if (fr != NULL) {
+        fr->evicting = true;
+        lock_release(&fr->lock);
+    }
+    return fr;
+}
+
+/*! frame_evict_page
+ *  
+ *  @description Evicts spg's page, if it is in a frame, writing it back.
+ */
+void frame_evict_page(struct supp_page *spg) {
+    struct frame *fr = frame_claim(spg);
+    if (fr != NULL)
+        frame_evict_batch(&fr, 1);
+}
+
+/*! frame_free_page
+ *  
+ *  @description Frees the frame holding spg's page, if any, without writing
+ *  the page anywhere.
+ */
+void frame_free_page(struct supp_page *spg) {
+    struct frame *fr = frame_claim(spg);
+    if (fr != NULL) {
+        pagedir_clear_page(spg->pd, spg->vaddr);
+        frame_release(fr);
+    }
 }
 
-/*! frame_choose_victim
+/*! frame_lru_init
  * 
- *  @description Chooses a frame whose page will be evicted to free it for the
- *  next page.
+ *  @description Initializes lru with empty lists.
+ */
+static void frame_lru_init(struct frame_lru *lru) {
+    list_init(&lru->active);
+    list_init(&lru->inactive);
+    lru->active_cnt = lru->inactive_cnt = 0;
+}
+
+/*! frame_lru_of
  * 
- *  @return a pointer to the frame whose page should be evicted.
+ *  @return the pair of lists fr belongs on.
  */
-struct frame *frame_choose_victim(void) {
-    // Implements second chance FIFO
-    while(1) {
-	    struct list_elem* cur = list_pop_front(&frame_table);
-        struct frame *cur_frame = list_entry(cur, struct frame, frame_elem);
-        struct supp_page *cur_page = cur_frame->page;
-        // If the frame has been accessed, give it a second chance by putting 
-        // it back in the queue with access bit reset
-        if (pagedir_is_accessed(cur_page->pd, cur_frame->phys_addr) ||
-                pagedir_is_accessed(cur_page->pd, cur_page->vaddr) ||
-                cur_frame->evicting || cur_frame->pinned) {
-            pagedir_set_accessed(cur_page->pd, cur_frame->phys_addr, false);
+static struct frame_lru *frame_lru_of(struct frame *fr) {
+    return fr->file ? &file_lru : &anon_lru;
+}
+
+/*! frame_lru_move
+ * 
+ *  @description Moves fr to the back of its active list if active, or of
+ *  its inactive list otherwise, clearing its referenced flag if it changes
+ *  lists.
+ */
+static void frame_lru_move(struct frame *fr, bool active) {
+    struct frame_lru *lru = frame_lru_of(fr);
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    list_remove(&fr->frame_elem);
+    if (fr->active != active) {
+        if (active) {
+            lru->inactive_cnt--;
+            lru->active_cnt++;
+            activate_cnt++;
+        } else {
+            lru->active_cnt--;
+            lru->inactive_cnt++;
+        }
+        fr->active = active;
+        fr->referenced = false;
+    }
+    list_push_back(active ? &lru->active : &lru->inactive, &fr->frame_elem);
+}
+
+/*! frame_evictable
+ * 
+ *  @description Frames that are pinned, already being evicted, or whose page
+ *  is not mapped yet because it is still being loaded cannot be evicted, and
+ *  their access bits don't mean anything yet either.  Called with fr->lock
+ *  held, which keeps fr->page from changing.
+ * 
+ *  @return fr's page if it could be evicted, or NULL.
+ */
+static struct supp_page *frame_evictable(struct frame *fr) {
+    struct supp_page *spg = fr->page;
+    if (fr->evicting || fr->pinned || spg == NULL ||
+        pagedir_get_page(spg->pd, spg->vaddr) == NULL)
+        return NULL;
+    return spg;
+}
+
+/*! frame_age_active
+ * 
+ *  @description Tops up lru's inactive list until it is as long as the
+ *  active one, looking at each active frame at most once, from the front.
+ *  Frames that have not been accessed since last looked at move to the back
+ *  of the inactive list; the others get a second chance at the back of the
+ *  active list, with their access bits reset, and so do those that cannot be
+ *  evicted.
+ */
+static void frame_age_active(struct frame_lru *lru) {
+    size_t max_scan = lru->active_cnt;
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    for (; max_scan > 0 && lru->inactive_cnt < lru->active_cnt; max_scan--) {
+        struct frame *cur_frame = list_entry(list_front(&lru->active),
+                                             struct frame, frame_elem);
+        struct supp_page *cur_page;
+        bool active = true;
+
+        lock_acquire(&cur_frame->lock);
+        cur_page = frame_evictable(cur_frame);
+        if (cur_page == NULL) {
+            /* Not evictable. */
+        } else if (pagedir_is_accessed(cur_page->pd, cur_page->vaddr)) {
             pagedir_set_accessed(cur_page->pd, cur_page->vaddr, false);
-            list_push_back(&frame_table, cur);
         } else {
-            // Otherwise the frame has already been removed so return it
-            return cur_frame;
+            active = false;
+        }
+        lock_release(&cur_frame->lock);
+
+        frame_lru_move(cur_frame, active);
+    }
+}
+
+/*! frame_scan_inactive
+ * 
+ *  @description Chooses a frame from lru's inactive list whose page will be
+ *  evicted to free it for the next page, and marks it evicting, looking
+ *  through the list from the front.  Accessed frames, whose access bits are
+ *  reset, are promoted to the active list, anonymous ones at once and file
+ *  ones if they were accessed when last looked at as well.  Frames that
+ *  cannot be evicted, and file frames accessed for the first time, go to the
+ *  back.  The first of the rest is the victim, which also goes to the back,
+ *  and leaves the table when it is freed.
+ * 
+ *  Only the user alias of each page's access bit is looked at.  The kernel
+ *  reaches pages through its own alias just to fill them and write them
+ *  back, except in pinned_kaddr(), which sets the user one itself.
+ * 
+ *  @return the frame whose page should be evicted, or NULL if none was found.
+ */
+static struct frame *frame_scan_inactive(struct frame_lru *lru) {
+    /* Two passes over the list give every file frame its second look. */
+    size_t max_scan = 2 * lru->inactive_cnt;
+
+    ASSERT(lock_held_by_current_thread(&frame_lock));
+
+    for (; max_scan > 0 && !list_empty(&lru->inactive); max_scan--) {
+        struct frame *cur_frame = list_entry(list_front(&lru->inactive),
+                                             struct frame, frame_elem);
+        struct supp_page *cur_page;
+        bool active = false, victim = false;
+
+        lock_acquire(&cur_frame->lock);
+        cur_page = frame_evictable(cur_frame);
+        if (cur_page == NULL) {
+            /* Not evictable. */
+        } else if (pagedir_is_accessed(cur_page->pd, cur_page->vaddr)) {
+            pagedir_set_accessed(cur_page->pd, cur_page->vaddr, false);
+            if (cur_frame->file && !cur_frame->referenced)
+                cur_frame->referenced = true;
+            else
+                active = true;
+        } else {
+            cur_frame->evicting = victim = true;
         }
+        lock_release(&cur_frame->lock);
+
+        frame_lru_move(cur_frame, active);
+        if (victim)
+            return cur_frame;
     }
+    return NULL;
 }
 
-/*! frame_evict
+/*! frame_scan_lru
+ * 
+ *  @description Chooses a frame on lru whose page will be evicted, ageing
+ *  the active list into the inactive one as needed.  Two rounds give active
+ *  frames that were accessed since last looked at their second chance.
+ * 
+ *  @return the frame whose page should be evicted, or NULL if none was found.
+ */
+static struct frame *frame_scan_lru(struct frame_lru *lru) {
+    struct frame *fr = NULL;
+    int round;
+
+    for (round = 0; round < 2 && fr == NULL; round++) {
+        frame_age_active(lru);
+        fr = frame_scan_inactive(lru);
+    }
+    return fr;
+}
+
+/*! frame_scan_victim
+ * 
+ *  @description Chooses a frame whose page will be evicted and marks it
+ *  evicting.  File pages are taken first, as long as their inactive list is
+ *  no shorter than their active one, since a large inactive list means pages
+ *  are being read once and not again, as by a scan through a mapping, and so
+ *  should make room before anything that has been used repeatedly.
+ *  Otherwise anonymous pages are taken first.  Either way the other kind is
+ *  tried if the first has nothing that can be evicted.
+ * 
+ *  @return the frame whose page should be evicted, or NULL if none was found.
+ */
+static struct frame *frame_scan_victim(void) {
+    struct frame *fr;
+    bool file_first = file_lru.inactive_cnt > 0 &&
+                      file_lru.inactive_cnt >= file_lru.active_cnt;
+
+    fr = frame_scan_lru(file_first ? &file_lru : &anon_lru);
+    if (fr == NULL)
+        fr = frame_scan_lru(file_first ? &anon_lru : &file_lru);
+    return fr;
+}
+
+/*! frame_evict_batch
  *  
- *  @description Evicts a page from a frame to free it for another page's use.
+ *  @description Evicts the pages in the cnt frames of victims, each of which
+ *  is marked evicting and so left alone by everyone else, and frees the
+ *  frames.  Runs without frame_lock, so that other threads keep faulting
+ *  during the I/O.  Each page is unmapped before it is written out, so that
+ *  its owner faults and waits for the eviction instead of changing it under
+ *  the write.  Swap pages all go out together so that they land in
+ *  neighbouring slots with as few requests as possible.
  */
-void frame_evict(struct frame *fr) {
-    fr->evicting = true;
+static void frame_evict_batch(struct frame *victims[], size_t cnt) {
+    struct supp_page *swapped[PAGEOUT_BATCH];
+    void *pages[PAGEOUT_BATCH];
+    size_t slots[PAGEOUT_BATCH];
+    size_t swap_cnt = 0, i;
+
+    ASSERT(!lock_held_by_current_thread(&frame_lock));
+    ASSERT(cnt <= PAGEOUT_BATCH);
+
+    for (i = 0; i < cnt; i++) {
+        struct frame *fr = victims[i];
+	    struct supp_page *spg = fr->page;
+        ASSERT(spg->fr == fr);
+        ASSERT(fr->evicting);
+
+        pagedir_clear_page(spg->pd, spg->vaddr);
+	    switch (spg->type) {
+		    case filesys :
+	            if (pagedir_is_dirty(spg->pd, spg->vaddr)) {
+	                /* If it is dirty, we need to store the data. */
+				    /* Write it back to the file. */
+				    file_write_at(spg->fil, fr->phys_addr, 
+                               spg->bytes, spg->offset);
+                    pagedir_set_dirty(spg->pd, spg->vaddr, false);
+		        }
+			    break;
+		    case swapslot :
+		        /* Write to a swap, below. */
+                swapped[swap_cnt] = spg;
+                pages[swap_cnt++] = fr->phys_addr;
+			    break;
+		    default :
+			    PANIC ("Error evicting frame.\n");
+			    break;
+	    }
+    }
+
+    swap_put_pages(pages, swap_cnt, slots);
+    for (i = 0; i < swap_cnt; i++)
+        swapped[i]->swap = slots[i];
+
+    /* Clear the pages and frames. */
+    for (i = 0; i < cnt; i++)
+        frame_release(victims[i]);
+}
+
+/*! frame_page_out
+ *  
+ *  @description Evicts up to cnt pages, as many as there are evictable
+ *  frames, in one batch, adding the number evicted to *evict_cnt.
+ *  
+ *  @return the number of frames freed.
+ */
+static size_t frame_page_out(size_t cnt, long long *evict_cnt) {
+    struct frame *victims[PAGEOUT_BATCH];
+    size_t n = 0;
+
+    ASSERT(cnt <= PAGEOUT_BATCH);
+    lock_acquire(&frame_lock);
+    while (n < cnt) {
+        struct frame *fr = frame_scan_victim();
+        if (fr == NULL)
+            break;
+        victims[n++] = fr;
+    }
+    *evict_cnt += n;
+    lock_release(&frame_lock);
+
+    frame_evict_batch(victims, n);
+    return n;
+}
+
+/*! pageout_daemon
+ *  
+ *  @description Sleeps until frame_create() finds free frames running low,
+ *  then evicts pages in batches until there are enough free frames again or
+ *  nothing is left that can be evicted.
+ */
+static void pageout_daemon(void *aux UNUSED) {
+    for (;;) {
+        sema_down(&pageout_sema);
+        while (palloc_free_cnt(PAL_USER) < pageout_high &&
+               frame_page_out(PAGEOUT_BATCH, &evict_async_cnt) > 0)
+            continue;
 
-    bool unlock = false;
-    if (!lock_held_by_current_thread(&frame_lock)) {
-        unlock = true;
         lock_acquire(&frame_lock);
+        pageout_pending = false;
+        lock_release(&frame_lock);
     }
-    
-	struct supp_page *spg = fr->page;
-    ASSERT(spg->fr == fr);
-    ASSERT(fr->evicting);
-	switch (spg->type) {
-		case filesys :
-	        if (pagedir_is_dirty(spg->pd, spg->vaddr)) {
-	            /* If it is dirty, we need to store the data. */
-				/* Write it back to the file. */
-				file_write_at(spg->fil, spg->fr->phys_addr, 
-                           spg->bytes, spg->offset);
-                pagedir_set_dirty(spg->pd, spg->vaddr, false);
-		    }
-			break;
-		case swapslot :
-		    /* Write to a swap. */
-			spg->swap = swap_put_page(spg->fr->phys_addr);
-			break;
-		default :
-			PANIC ("Error evicting frame.\n");
-			break;
-	}
+}
 
-    /* Clear the page and frame. */
-    ASSERT(!frame_free(spg->fr));
-    spg->fr = NULL;
-    if (unlock) lock_release(&frame_lock);
+/*! frame_print_stats
+ *  
+ *  @description Prints eviction and replacement statistics.
+ */
+void frame_print_stats(void) {
+    printf("Frames: %lld evicted by faulting threads, %lld paged out ahead, "
+           "%lld activated\n", evict_sync_cnt, evict_async_cnt, activate_cnt);
 }
@@ -2,6 +2,8 @@
 #define VM_FRAME
 
 #include <list.h>
+#include <stdbool.h>
+#include "threads/synch.h"
 
 
 struct frame {
@@ -10,13 +12,25 @@ struct frame {
                                no memory sharing
                                each frame corresponds to at most one page. */
 	struct list_elem frame_elem; /* Element for keeping a list of frames */
-    int pinned;
-   	bool evicting;
+    struct lock lock;	/* Protects pinned and evicting. */
+    struct condition evicted;	/* Signalled when an eviction finishes. */
+    int pinned;	/* Number of pins keeping the frame from eviction. */
+   	bool evicting;	/* Set while the page is being evicted. */
+    bool file;	/* Holds a file page rather than an anonymous one. */
+    bool active;	/* On its list's active rather than inactive list. */
+    bool referenced;	/* File page seen accessed once while inactive. */
 };
 
+struct supp_page;
+
 void init_frame_table(void); /* Initializes the frame table. */
-struct frame *frame_create(int flags, bool pinned); /* Gets a page from user pool and adds it to frame table. */
+struct frame *frame_create(int flags, bool pinned, bool file); /* Gets a page from user pool and adds it to frame table. */
 int frame_free(struct frame *fr); /* Frees page and removes frame from table. */
-void frame_evict(struct frame *fr); /* Evicts a page from a frame to free it up. */
+struct frame *frame_lock_page(struct supp_page *spg); /* Locks page's frame. */
+bool frame_pin(struct supp_page *spg); /* Keeps page's frame from eviction. */
+void frame_unpin(struct frame *fr); /* Undoes frame_pin(). */
+void frame_evict_page(struct supp_page *spg); /* Writes page back, frees frame. */
+void frame_free_page(struct supp_page *spg); /* Frees page's frame. */
+void frame_print_stats(void); /* Prints eviction statistics. */
 
 #endif // #ifndef VM_FRAME
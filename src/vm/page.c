@@ -56,10 +56,10 @@ void init_supp_page_table(struct hash *table) {
 
 void free_action_func(struct hash_elem *elem, void *aux UNUSED) {
     struct supp_page *page = hash_entry(elem, struct supp_page, elem);
-    if (page->fr && page->type == filesys) frame_evict(page->fr);
-    else if (page->fr) frame_free(page->fr);
+    if (page->type == filesys) frame_evict_page(page);
+    else frame_free_page(page);
 
-    if (page->type == swapslot && page->swap) swap_remove_page(page->swap);
+    if (page->type == swapslot && page->swap != SWAP_NONE) swap_remove_page(page->swap);
     pagedir_clear_page(thread_current()->pagedir, page->vaddr);
     free(page);
 }
@@ -116,10 +116,18 @@ bool valid_page_data(struct hash *table, void *vaddr) {
  *  @return A pointer to the new frame or NULL if no frame obtained.
  */
 struct frame *page_to_new_frame(struct supp_page *spg, bool pinned) {
-	ASSERT(!spg->fr || spg->fr->evicting);
+	/* Wait out any eviction of the page, so that its data is back where spg
+	 * says. */
+	struct frame *old_frame = frame_lock_page(spg);
+	ASSERT(old_frame == NULL);
+
+    /* Writable pages of the executable become swap pages once loaded. */
+    bool exec_data = spg->type == filesys && spg->wr &&
+                     spg->fil == process_current()->file;
     		
 	/* Create a new frame to load vaddr's data into. */
-    struct frame *new_frame = frame_create(PAL_USER | PAL_ZERO, pinned);
+    struct frame *new_frame = frame_create(PAL_USER | PAL_ZERO, pinned,
+                                           spg->type == filesys && !exec_data);
     new_frame->page = spg;
     spg->fr = new_frame;
 	
@@ -129,18 +137,19 @@ struct frame *page_to_new_frame(struct supp_page *spg, bool pinned) {
 			if (file_read_at(spg->fil, new_frame->phys_addr, spg->bytes, spg->offset) != (int) spg->bytes) {
 				PANIC("Error with page fault\n");
 			}
-            if (spg->wr && spg->fil == process_current()->file) {
+            if (exec_data) {
                 // If the page is linked to the current executable, but
                 // is also writable, then turn it into a swap page
                 spg->type = swapslot;
                 spg->fil = NULL;
                 spg->offset = 0;
                 spg->bytes = 0;
-                spg->swap = NULL;
+                spg->swap = SWAP_NONE;
             }
 			break;
 		case swapslot : /* Read from swap slot. */
 			swap_retrieve_page(new_frame->phys_addr, spg->swap);
+			spg->swap = SWAP_NONE;
 			break;
 		default : /* Something went terribly wrong if not one of the enums. */
 			PANIC("Unknown error when handling page fault.\n");
@@ -209,7 +218,7 @@ struct supp_page *create_filesys_page(struct hash *table, void *vaddr, uint32_t
 	new_page->wr = writable;
 	new_page->pd = pd;
 	
-	new_page->swap = NULL;
+	new_page->swap = SWAP_NONE;
 
 	return new_page;
 }
@@ -235,7 +244,7 @@ struct supp_page *create_swapslot_page(struct hash *table, void *vaddr, uint32_t
 	new_page->wr = writable;
 	new_page->pd = pd;
 
-    new_page->swap = NULL;
+    new_page->swap = SWAP_NONE;
 	
 	return new_page;
 }
@@ -244,15 +253,8 @@ struct supp_page *create_swapslot_page(struct hash *table, void *vaddr, uint32_t
 void pin_page(struct hash *table, void *vaddr){
 	void *upage = pg_round_down(vaddr);
 	struct supp_page *spg = get_supp_page(table, upage);
-	while (spg->fr && spg->fr->evicting) {
-
-	}
 	ASSERT(spg);
-	if (spg->fr){
-		ASSERT(spg->fr->pinned >= 0);
-		spg->fr->pinned++;
-	}
-	else
+	if (!frame_pin(spg))
 		page_to_new_frame(spg, true);
 }
 
@@ -261,7 +263,52 @@ void unpin_page(struct hash *table, void *vaddr){
 	struct supp_page *spg = get_supp_page(table, upage);
 	ASSERT(spg);
 	ASSERT(spg->fr);
+	frame_unpin(spg->fr);
+}
+
+/*! pin_pages
+ * 
+ *  @description Pins every page that holds part of the size bytes starting
+ *  at vaddr, each of which must be mapped.
+ */
+void pin_pages(struct hash *table, const void *vaddr, size_t size){
+	uint8_t *page;
+	if (size == 0)
+		return;
+	for (page = pg_round_down(vaddr); page < (uint8_t *) vaddr + size;
+	     page += PGSIZE)
+		pin_page(table, page);
+}
+
+/*! unpin_pages
+ * 
+ *  @description Unpins the pages pinned by pin_pages.
+ */
+void unpin_pages(struct hash *table, const void *vaddr, size_t size){
+	uint8_t *page;
+	if (size == 0)
+		return;
+	for (page = pg_round_down(vaddr); page < (uint8_t *) vaddr + size;
+	     page += PGSIZE)
+		unpin_page(table, page);
+}
+
+/*! pinned_kaddr
+ * 
+ *  @description Returns the kernel address of the byte at user address
+ *  vaddr, whose page must be pinned, so that the kernel can get at it from
+ *  any thread, such as the disk driver's.  The page is marked accessed, and
+ *  if write dirty, since access through the kernel address doesn't do that.
+ * 
+ *  @return a pointer into the page's frame
+ */
+void *pinned_kaddr(struct hash *table, const void *vaddr, bool write){
+	struct supp_page *spg = get_supp_page(table, pg_round_down(vaddr));
+	ASSERT(spg);
+	ASSERT(spg->fr);
 	ASSERT(spg->fr->pinned > 0);
-	ASSERT(!spg->fr->evicting);
-	spg->fr->pinned--;
+	pagedir_set_accessed(spg->pd, spg->vaddr, true);
+	if (write)
+		pagedir_set_dirty(spg->pd, spg->vaddr, true);
+	return (uint8_t *) spg->fr->phys_addr + pg_ofs(vaddr);
 }
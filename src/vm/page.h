@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <hash.h>
+#include <stddef.h>
 
 #include "frame.h"
 #include "threads/vaddr.h"
@@ -30,7 +31,7 @@ struct supp_page {
 	int bytes; /* Number of bytes of relevant data. */
 	
 	/* Only useful for swap type. */
-	struct swap_slot *swap; /* Info about location of data in swap. */
+	size_t swap; /* Slot holding the data in swap, or SWAP_NONE. */
 };
 
 /* Initializes supplemental page table. */
@@ -52,4 +53,7 @@ struct supp_page *create_swapslot_page(struct hash *table, void *vaddr,
 
 void pin_page(struct hash *table, void *vaddr);
 void unpin_page(struct hash *table, void *vaddr);
+void pin_pages(struct hash *table, const void *vaddr, size_t size);
+void unpin_pages(struct hash *table, const void *vaddr, size_t size);
+void *pinned_kaddr(struct hash *table, const void *vaddr, bool write);
 #endif // #ifndef VM_PAGE
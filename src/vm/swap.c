@@ -3,6 +3,7 @@
  *  Contains methods for using the swap table. 
  */
 
+#include <bitmap.h>
 #include <debug.h>
 #include <inttypes.h>
 #include <round.h>
@@ -30,18 +31,27 @@
 #include "swap.h"
 
 static struct block *swap_table;
-static struct swap_slot *swap_slots;
 
-struct swap_slot *swap_find_empty(void); /* Finds empty page in swap table. */
+/* One bit per page-sized slot of the swap block, set if the slot is in use,
+ * and where the next search for free slots starts.  Both are protected by
+ * swap_lock; the I/O is done without it. */
+static struct bitmap *swap_map;
+static size_t swap_cursor;
+static struct lock swap_lock;
 
-block_sector_t block_sector_num(int swap_index);
+#define SECTORS_PER_SLOT (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static size_t swap_alloc(size_t *cnt);
+static void swap_write(size_t slot, void *const pages[], size_t cnt);
+
+block_sector_t block_sector_num(size_t swap_index);
 
 /**
  * For the given swap index, find the start position of
  * memory on the swap device.
  */
-block_sector_t block_sector_num(int swap_index) {
-    return (PGSIZE / BLOCK_SECTOR_SIZE) * swap_index;
+block_sector_t block_sector_num(size_t swap_index) {
+    return SECTORS_PER_SLOT * swap_index;
 }
 
 /*! init_swap_table
@@ -52,58 +62,77 @@ void init_swap_table (void) {
 	/* Initialize swap table to point to swap block. */
 	swap_table = block_get_role(BLOCK_SWAP);
 	
-	/* Create an array of slots so we can easily find free slots.  We want
-	 * one entry in the array for every page in the swap block. */
-	int num_slots = block_size(swap_table) * BLOCK_SECTOR_SIZE / PGSIZE;
-	swap_slots = (struct swap_slot *)malloc(num_slots * sizeof(struct swap_slot));
-	
-    /* Initialize swap array.  Each successive element in the array points
-	 * to the next entry in the swap table, each of which are separated by
-	 * PGSIZE.  No swap entries should be in_use at this point. */
-	int i;
-	for (i = 0; i < num_slots; i++) {
-		swap_slots[i].slot_num = i;
-		swap_slots[i].in_use = false;
-	}
+	/* One bit for every page in the swap block, none in use yet. */
+	size_t num_slots = swap_table != NULL ?
+		block_size(swap_table) / SECTORS_PER_SLOT : 0;
+	swap_map = bitmap_create(num_slots);
+	if (swap_map == NULL)
+		PANIC("Failed to allocate swap table");
+	swap_cursor = 0;
+	lock_init(&swap_lock);
 }
 
-/*! swap_find_empty
+/*! swap_alloc
  * 
- *  @description Finds the first empty swap page in the swap block.
+ *  @description Finds *cnt neighbouring free slots, starting the search where
+ *  the last one left off and wrapping around, and marks them in use.  If
+ *  there is no such run, settles for a shorter one, halving *cnt until one
+ *  is found.  Searching on from the cursor keeps allocation cost flat and
+ *  lays out pages swapped out one after another next to each other.
  * 
- *  @return pointer to first empty swap, or NULL if the swap block is full.
+ *  @return the first slot of the run, or SWAP_NONE if the swap block is full.
  */
-struct swap_slot *swap_find_empty(void) {
-	/* Calculate number of swaps so we know how much to iterate. */
-	int num_swaps = block_size(swap_table) * BLOCK_SECTOR_SIZE / PGSIZE;
-	
-	/* Iterate over array to see if there are any free swaps.  Return first
-	 * one we find because they are all the same size, so there is no chance
-	 * of finding a better one by continuing iterating. */
-	int i;
-	for (i = 0; i < num_swaps; i++) {
-		/* Attribute in_use false if the slot is free. */
-		if (!swap_slots[i].in_use) {
-			swap_slots[i].in_use = true;
-            return &swap_slots[i];
-        }
-	}	
-	/* If here, found no empty swaps. */
-	return NULL;
+static size_t swap_alloc(size_t *cnt) {
+	size_t slot = BITMAP_ERROR;
+
+	ASSERT(*cnt > 0);
+	lock_acquire(&swap_lock);
+	for (;;) {
+		slot = bitmap_scan_and_flip(swap_map, swap_cursor, *cnt, false);
+		if (slot == BITMAP_ERROR && swap_cursor > 0)
+			slot = bitmap_scan_and_flip(swap_map, 0, *cnt, false);
+		if (slot != BITMAP_ERROR || *cnt == 1)
+			break;
+		*cnt /= 2;
+	}
+	if (slot != BITMAP_ERROR)
+		swap_cursor = (slot + *cnt) % bitmap_size(swap_map);
+	lock_release(&swap_lock);
+	return slot != BITMAP_ERROR ? slot : SWAP_NONE;
+}
+
+/*! swap_write
+ * 
+ *  @description Writes the cnt pages to the neighbouring slots starting at
+ *  slot with one request.
+ */
+static void swap_write(size_t slot, void *const pages[], size_t cnt) {
+	const void *buffers[SWAP_CLUSTER * SECTORS_PER_SLOT];
+	size_t i;
+
+	ASSERT(cnt <= SWAP_CLUSTER);
+	for (i = 0; i < cnt * SECTORS_PER_SLOT; i++)
+		buffers[i] = (const uint8_t *) pages[i / SECTORS_PER_SLOT] +
+			i % SECTORS_PER_SLOT * BLOCK_SECTOR_SIZE;
+	block_write_vector(swap_table, block_sector_num(slot), buffers,
+	                   cnt * SECTORS_PER_SLOT);
 }
 
 /*! swap_remove_page
  * 
  *  @description Removes a swap page from the swap table by marking it as
- *  not in_use
+ *  not in use.
  * 
- *  @param swap - Pointer to the swap slot entry in the array.
+ *  @param slot - The slot the page is in.
  */
-void swap_remove_page(struct swap_slot *swap) {
-	ASSERT (swap != NULL);
+void swap_remove_page(size_t slot) {
+	ASSERT (slot != SWAP_NONE);
 	
-    /* Mark page as unused. */
-	swap->in_use = false;
+	/* Mark page as unused. */
+	lock_acquire(&swap_lock);
+	ASSERT (bitmap_test(swap_map, slot));
+	bitmap_reset(swap_map, slot);
+	lock_release(&swap_lock);
 }
 
 /*! swap_retrieve_page
@@ -114,22 +143,20 @@ void swap_remove_page(struct swap_slot *swap) {
  * 
  *  @param addr - The destination for copying swap to address.  It is assumed
  *  that PGSIZE bytes can be written starting at this address.
- *  @param swap - Pointer to the swap that contains desired data.
+ *  @param slot - The slot that contains desired data.
  * 
  *  @return Number of bytes copied.  Should be PGSIZE unless error occurs.
  */
-int swap_retrieve_page(void *dest, struct swap_slot *swap) {
+int swap_retrieve_page(void *dest, size_t slot) {
 
-	ASSERT (swap != NULL);
+	ASSERT (slot != SWAP_NONE);
 	
-	/* Copy the page's contents. */
-    int i;
-    for (i = 0; i < PGSIZE / BLOCK_SECTOR_SIZE; i++) {
-        block_read(swap_table, block_sector_num(swap->slot_num) + i, dest + BLOCK_SECTOR_SIZE * i);
-    }
+	/* Copy the page's contents, all of its sectors in one request. */
+	block_read_multiple(swap_table, block_sector_num(slot),
+	                    SECTORS_PER_SLOT, dest);
 
-    /* Mark slot as unused. */
-	swap_remove_page(swap);
+	/* Mark slot as unused. */
+	swap_remove_page(slot);
 
 	return PGSIZE;
 }
@@ -137,24 +164,41 @@ int swap_retrieve_page(void *dest, struct swap_slot *swap) {
 /*! swap_put_page
  * 
  *  @description Copies the contents at the argued address into an open swap
- *  page, then returns the address of the page.  If no swap page available,
- *  NULL is returned and it is up to the caller to handle accordingly.
+ *  page, then returns the slot it went to.  Panics if the swap block is
+ *  full.
  * 
  *  @param addr - Pointer to the page to copy into a swap.
  * 
- *  @return pointer to the swap_slot copied into or NULL if none exists
+ *  @return the slot copied into
  */
-struct swap_slot *swap_put_page (void *addr) {
-	/* Find a place in the swap block to put the page. */
-	struct swap_slot *swap_page = swap_find_empty();
-    ASSERT(swap_page);
-	
-	/* Copy the contents of the page into the swap if address valid. */
-    int i;
-    for (i = 0; i < PGSIZE / BLOCK_SECTOR_SIZE; i++) {
-        block_write(swap_table, block_sector_num(swap_page->slot_num) + i, addr + BLOCK_SECTOR_SIZE * i);
-    }
-
-	return swap_page;
+size_t swap_put_page (void *addr) {
+	size_t slot;
+	swap_put_pages(&addr, 1, &slot);
+	return slot;
 }
 
+/*! swap_put_pages
+ * 
+ *  @description Copies the cnt pages at the argued addresses into swap,
+ *  putting as many of them as it can in neighbouring slots so that each
+ *  cluster goes out with one request, and stores the slot each page went to
+ *  in slots.  Panics if the swap block is full.
+ * 
+ *  @param pages - Pointers to the pages to copy into swap.
+ *  @param cnt - Number of pages.
+ *  @param slots - Where to put the slot of each page.
+ */
+void swap_put_pages(void *const pages[], size_t cnt, size_t slots[]) {
+	size_t done = 0, n, slot, i;
+
+	while (done < cnt) {
+		n = cnt - done < SWAP_CLUSTER ? cnt - done : SWAP_CLUSTER;
+		slot = swap_alloc(&n);
+		if (slot == SWAP_NONE)
+			PANIC("Swap is full");
+		swap_write(slot, pages + done, n);
+		for (i = 0; i < n; i++)
+			slots[done + i] = slot + i;
+		done += n;
+	}
+}
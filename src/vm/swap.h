@@ -1,20 +1,25 @@
 #ifndef VM_SWAP
 #define VM_SWAP
 
-struct swap_slot {
-	/* Address of the swap inside the block. */
-	int slot_num; 
-	/* True if the swap is used, false if the swap is empty. */
-	bool in_use; 
-};
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pages written to swap with one request at most.  Pages evicted together
+ * go to neighbouring slots, up to this many. */
+#define SWAP_CLUSTER 8
+
+/* Slot number meaning "not in swap". */
+#define SWAP_NONE SIZE_MAX
 
 /* Initializes empty swap table. */
 void init_swap_table(void); 
 /* Copies page into swap table. */
-struct swap_slot *swap_put_page(void *addr); 
+size_t swap_put_page(void *addr); 
+/* Copies pages into neighbouring slots of the swap table. */
+void swap_put_pages(void *const pages[], size_t cnt, size_t slots[]);
 /* Copies swap to argued address. */
-int swap_retrieve_page(void *dest, struct swap_slot *swap); 
+int swap_retrieve_page(void *dest, size_t slot); 
 /* Marks swap as available. */
-void swap_remove_page(struct swap_slot *swap); 
+void swap_remove_page(size_t slot); 
 
 #endif // #ifndef VM_SWAP